@@ -14,6 +14,10 @@ def parse_args(args=None):
 
     default_version = DROPBOT_VERSION
     parser.add_argument('-V', '--version', default=default_version)
+    parser.add_argument('-m', '--map-file',
+                        default='.pioenvs/teensy31/firmware.map',
+                        help='Linker map output path (used by '
+                        '`python -m dropbot_dx.bin.sram_report`).')
     parser.add_argument('arg', nargs='*')
 
     return parser.parse_known_args(args=args)
@@ -23,6 +27,7 @@ if __name__ == '__main__':
     args, extra_args = parse_args()
 
     extra_args += [r'-DDEVICE_ID_RESPONSE=\"dropbot-dx::{}\"'
-                   .format(args.version)]
+                   .format(args.version),
+                   '-Wl,-Map,{}'.format(args.map_file)]
 
     print(' '.join(extra_args))
@@ -0,0 +1,77 @@
+'''
+Measure the throughput of :class:`dropbot_dx.data_logger.DataLogger` with
+120-channel state records (as logged by
+:meth:`~dropbot_dx.data_logger.DataLogger.log_state`).
+
+Example:
+
+    python -m dropbot_dx.bin.logger_benchmark -n 100000 benchmark.h5
+'''
+from __future__ import division, print_function
+import argparse
+import os
+import sys
+import time
+
+import numpy as np
+import pandas as pd
+
+from ..data_logger import DataLogger
+
+
+def benchmark(path, n_records, number_of_channels=120, **kwargs):
+    '''
+    Log ``n_records`` state records to ``path`` (as fast as possible).
+
+    Parameters
+    ----------
+    path : str
+        HDF5 output file (overwritten).
+    n_records : int
+    number_of_channels : int, optional
+    **kwargs
+        Passed to :class:`dropbot_dx.data_logger.DataLogger`.
+
+    Returns
+    -------
+    pandas.Series
+        Records per second queued (caller side) and written (including
+        closing the file), followed by the logger statistics.
+    '''
+    if os.path.exists(path):
+        os.remove(path)
+    kwargs.setdefault('max_queued', n_records)
+    states = np.zeros(number_of_channels, dtype='uint8')
+    start = time.time()
+    with DataLogger(path, **kwargs) as logger:
+        for i in range(n_records):
+            states[i % number_of_channels] ^= 1
+            logger.log('state', state_of_channels=states, voltage=100.,
+                       frequency=1e3, hv_output_enabled=True)
+        queue_s = time.time() - start
+    total_s = time.time() - start
+    return pd.concat([pd.Series([n_records / queue_s, n_records / total_s],
+                                index=['queued_per_s', 'written_per_s']),
+                      logger.statistics])
+
+
+def parse_args(args=None):
+    if args is None:
+        args = sys.argv[1:]
+    parser = argparse.ArgumentParser(description='Measure data logger '
+                                     'throughput.')
+    parser.add_argument('output', help='HDF5 output file (overwritten).')
+    parser.add_argument('-n', '--records', type=int, default=100000,
+                        help='Number of records (default: %(default)s).')
+    parser.add_argument('-c', '--compression', default='gzip',
+                        help='HDF5 compression filter (default: '
+                        '%(default)s).')
+    return parser.parse_args(args)
+
+
+if __name__ == '__main__':
+    args = parse_args()
+
+    compression = None if args.compression == 'none' else args.compression
+    print(benchmark(args.output, args.records, compression=compression)
+          .to_string())
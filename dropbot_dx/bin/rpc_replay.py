@@ -0,0 +1,63 @@
+'''
+Replay a recorded RPC session (see :mod:`dropbot_dx.rpc_record`) against a
+connected DropBot DX (or a simulator), and report latency, throughput and
+response mismatches.
+
+Example:
+
+    python -m dropbot_dx.bin.rpc_replay session.jsonl
+    python -m dropbot_dx.bin.rpc_replay -s 4 session.jsonl
+    python -m dropbot_dx.bin.rpc_replay --max-rate -o frames.csv session.jsonl
+'''
+from __future__ import print_function
+import argparse
+import sys
+
+from ..rpc_record import RecordingSimulator, load_recording, replay
+
+
+def parse_args(args=None):
+    if args is None:
+        args = sys.argv[1:]
+    parser = argparse.ArgumentParser(description='Replay recorded DropBot DX '
+                                     'RPC session.')
+    parser.add_argument('recording', help='Recording (JSON lines).')
+    speed = parser.add_mutually_exclusive_group()
+    speed.add_argument('-s', '--speed', type=float, default=1.,
+                       help='Speed relative to recording (default: '
+                       '%(default)s).')
+    speed.add_argument('--max-rate', action='store_true', help='Send each '
+                       'request as soon as the previous response arrives.')
+    parser.add_argument('-i', '--ignore-command', type=lambda x: int(x, 0),
+                        action='append', default=[], help='Command code to '
+                        'exclude from response comparison (may be repeated).')
+    parser.add_argument('-o', '--output', help='Write per-request results to '
+                        'CSV file.')
+    target = parser.add_mutually_exclusive_group()
+    target.add_argument('-p', '--port', help='Serial port (default: first '
+                        'DropBot DX found).')
+    target.add_argument('--simulate', action='store_true', help='Replay '
+                        'against a simulator answering with the recorded '
+                        'responses.')
+    return parser.parse_args(args)
+
+
+if __name__ == '__main__':
+    args = parse_args()
+
+    recording = load_recording(args.recording)
+    if args.simulate:
+        target = RecordingSimulator(recording)
+    else:
+        from ..proxy import SerialProxy
+
+        kwargs = {} if args.port is None else {'port': args.port}
+        target = SerialProxy(**kwargs)
+    result = replay(target, recording,
+                    speed=None if args.max_rate else args.speed,
+                    ignore_commands=args.ignore_command)
+    print(result['summary'].to_string())
+    if args.output:
+        result['frames'].to_csv(args.output)
+    if result['summary']['mismatches']:
+        sys.exit(1)
@@ -0,0 +1,133 @@
+'''
+Report static SRAM usage of the firmware from a GNU linker map file.
+
+The map file is written by the linker during `pio run` (see the `--map-file`
+argument in `build_flags.py`).
+
+Example:
+
+    python -m dropbot_dx.bin.sram_report .pioenvs/teensy31/firmware.map
+
+To show the SRAM saved (or lost) relative to an earlier build, pass the map
+file of the earlier build using `--baseline`:
+
+    python -m dropbot_dx.bin.sram_report -b old.map .pioenvs/teensy31/firmware.map
+'''
+from __future__ import print_function
+import argparse
+import re
+import sys
+
+import pandas as pd
+
+#: Output sections that are allocated in SRAM.
+SRAM_SECTIONS = ('.data', '.bss', '.dmabuffers', '.usbdescriptortable')
+
+CRE_SECTION = re.compile(r'^ (?P<section>\.[\w.]+|COMMON)'
+                         r'(?:\s+0x(?P<address>[0-9a-f]+)'
+                         r'\s+0x(?P<size>[0-9a-f]+)\s+(?P<source>\S+))?\s*$')
+CRE_CONTINUATION = re.compile(r'^\s+0x(?P<address>[0-9a-f]+)'
+                              r'\s+0x(?P<size>[0-9a-f]+)\s+(?P<source>\S+)\s*$')
+
+
+def read_map(map_path):
+    '''
+    Parameters
+    ----------
+    map_path : str
+        Path to GNU linker map file.
+
+    Returns
+    -------
+    pandas.DataFrame
+        Table of SRAM input sections (one row per symbol when the firmware is
+        compiled with `-fdata-sections`), with the columns `section`,
+        `symbol`, `address`, `size` and `source`.
+    '''
+    rows = []
+    pending = None
+
+    with open(map_path, 'r') as input_:
+        for line in input_:
+            if pending is not None:
+                # Long section names are followed by address/size on the next
+                # line.
+                match = CRE_CONTINUATION.match(line)
+                if match:
+                    rows.append(dict(pending, **match.groupdict()))
+                pending = None
+                continue
+            match = CRE_SECTION.match(line)
+            if not match:
+                continue
+            section = match.group('section')
+            if not (section == 'COMMON' or
+                    any(section == s or section.startswith(s + '.')
+                        for s in SRAM_SECTIONS)):
+                continue
+            info = {'section': section}
+            if match.group('address') is None:
+                pending = info
+            else:
+                rows.append(dict(info, **match.groupdict()))
+
+    df_sections = pd.DataFrame(rows, columns=['section', 'address', 'size',
+                                              'source'])
+    df_sections['address'] = df_sections.address.map(lambda v: int(v, 16))
+    df_sections['size'] = df_sections['size'].map(lambda v: int(v, 16))
+    # Drop entries that were discarded by the linker (address zero) and empty
+    # sections.
+    df_sections = df_sections.loc[(df_sections.address > 0) &
+                                  (df_sections['size'] > 0)].copy()
+    df_sections.insert(1, 'symbol', df_sections.section
+                       .map(lambda v: v.split('.', 2)[-1]
+                            if v.count('.') > 1 else v))
+    return df_sections.reset_index(drop=True)
+
+
+def sram_usage(map_path):
+    '''
+    Returns
+    -------
+    pandas.Series
+        SRAM bytes used by each symbol, sorted from largest to smallest.
+    '''
+    df_sections = read_map(map_path)
+    return (df_sections.groupby('symbol')['size'].sum()
+            .sort_values(ascending=False))
+
+
+def parse_args(args=None):
+    if args is None:
+        args = sys.argv[1:]
+    parser = argparse.ArgumentParser(description='Report static SRAM usage '
+                                     'from a linker map file.')
+    parser.add_argument('map_file')
+    parser.add_argument('-b', '--baseline', help='Map file of an earlier build '
+                        'to compare against.')
+    parser.add_argument('-n', '--count', type=int, default=20,
+                        help='Number of largest symbols to list (default: '
+                        '%(default)s).')
+    return parser.parse_args(args)
+
+
+if __name__ == '__main__':
+    args = parse_args()
+
+    usage = sram_usage(args.map_file)
+    if args.baseline is None:
+        print(usage.head(args.count).to_string())
+        print('\nTotal static SRAM: %d bytes' % usage.sum())
+    else:
+        baseline = sram_usage(args.baseline)
+        df_usage = pd.concat([baseline, usage], axis=1,
+                             keys=['baseline', 'current']).fillna(0)
+        df_usage = df_usage.astype(int)
+        df_usage['saved'] = df_usage.baseline - df_usage.current
+        df_usage = df_usage.loc[df_usage.saved != 0]
+        df_usage = df_usage.loc[df_usage.saved.abs()
+                                .sort_values(ascending=False).index]
+        print(df_usage.head(args.count).to_string())
+        print('\nTotal static SRAM: %d bytes (baseline: %d bytes, saved: %d '
+              'bytes)' % (usage.sum(), baseline.sum(),
+                          baseline.sum() - usage.sum()))
@@ -0,0 +1,155 @@
+'''
+Dump the event trace (flight recorder) of a connected DropBot DX as a
+timeline.
+
+Example:
+
+    python -m dropbot_dx.bin.trace_dump trace.csv
+    python -m dropbot_dx.bin.trace_dump -f chrome trace.json
+
+Chrome trace JSON files may be opened in `chrome://tracing` (or
+https://ui.perfetto.dev).
+'''
+from __future__ import print_function
+import argparse
+import json
+import sys
+
+import numpy as np
+import pandas as pd
+
+#: Record layout (see `TraceRecord` in `src/TraceBuffer.h`).
+TRACE_RECORD_DTYPE = np.dtype([('cycles', '<u4'), ('type', 'u1'),
+                               ('a', 'u1'), ('b', '<u2')])
+#: Event names, by record type (see `trace_event_t` in `src/TraceBuffer.h`).
+EVENT_NAMES = {1: 'rpc_begin', 2: 'rpc_end', 3: 'channels', 4: 'voltage',
+               5: 'frequency', 6: 'hv_output', 7: 'servo', 8: 'dma_done'}
+
+
+def read_trace(proxy, sequence=0, chunk_size=32):
+    '''
+    Read trace records from the device (recording is not interrupted).
+
+    Parameters
+    ----------
+    proxy : dropbot_dx.proxy.ProxyMixin
+    sequence : int, optional
+        Sequence number of the first record to read.  Records that were
+        already overwritten are skipped.
+    chunk_size : int, optional
+        Number of records to request per call.
+
+    Returns
+    -------
+    pandas.DataFrame
+        Decoded records (see :func:`decode_trace`).
+    '''
+    head = proxy.trace_head()
+    chunks = []
+    while sequence < head:
+        data = np.asarray(proxy.trace_read(sequence, chunk_size),
+                          dtype='uint8')
+        first = int(data[:4].view('<u4')[0])
+        records = data[4:].view(TRACE_RECORD_DTYPE)
+        if not records.size:
+            break
+        df_chunk = pd.DataFrame(records)
+        df_chunk.insert(0, 'sequence', np.arange(first, first + records.size))
+        chunks.append(df_chunk)
+        sequence = first + records.size
+    if chunks:
+        df_records = pd.concat(chunks, ignore_index=True)
+    else:
+        df_records = pd.DataFrame(columns=['sequence'] +
+                                  list(TRACE_RECORD_DTYPE.names))
+    return decode_trace(df_records, proxy.D__F_CPU())
+
+
+def decode_trace(df_records, f_cpu):
+    '''
+    Parameters
+    ----------
+    df_records : pandas.DataFrame
+        Raw records with ``sequence``, ``cycles``, ``type``, ``a`` and ``b``
+        columns.
+    f_cpu : int
+        CPU clock frequency (Hz) of the device.
+
+    Returns
+    -------
+    pandas.DataFrame
+        Records with the added columns ``time_us`` (relative to the first
+        record) and ``event``.
+
+    Notes
+    -----
+    The cycle counter wraps every ``2 ** 32 / f_cpu`` seconds (e.g., about
+    45 s at 96 MHz), so consecutive records are assumed to be closer together
+    than that.
+    '''
+    df_trace = df_records.copy()
+    cycles = df_trace['cycles'].values.astype('uint32')
+    elapsed = np.concatenate([[0], np.cumsum(np.diff(cycles)
+                                             .astype('uint32')
+                                             .astype('uint64'))])
+    df_trace['time_us'] = elapsed * 1e6 / f_cpu
+    df_trace['event'] = df_trace['type'].map(EVENT_NAMES).fillna('unknown')
+    return df_trace
+
+
+def to_chrome_trace(df_trace):
+    '''
+    Returns
+    -------
+    dict
+        Trace in the `Chrome trace event format`_, with RPC dispatches as
+        duration events and all other records as instant events.
+
+    .. _Chrome trace event format: https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+    '''
+    events = []
+    for row in df_trace.itertuples():
+        event = {'ts': row.time_us, 'pid': 0, 'args': {'a': int(row.a),
+                                                        'b': int(row.b),
+                                                        'sequence':
+                                                        int(row.sequence)}}
+        if row.event in ('rpc_begin', 'rpc_end'):
+            event.update(name='rpc 0x%04x' % row.b, cat='rpc', tid=0,
+                         ph='B' if row.event == 'rpc_begin' else 'E')
+        else:
+            event.update(name=row.event, cat=row.event, tid=1, ph='i', s='t')
+        events.append(event)
+    return {'traceEvents': events, 'displayTimeUnit': 'ms'}
+
+
+def parse_args(args=None):
+    if args is None:
+        args = sys.argv[1:]
+    parser = argparse.ArgumentParser(description='Dump DropBot DX event '
+                                     'trace.')
+    parser.add_argument('output', help='Output file (`-` for stdout).')
+    parser.add_argument('-f', '--format', choices=['csv', 'chrome'],
+                        default='csv')
+    parser.add_argument('-p', '--port', help='Serial port (default: first '
+                        'DropBot DX found).')
+    return parser.parse_args(args)
+
+
+if __name__ == '__main__':
+    from ..proxy import SerialProxy
+
+    args = parse_args()
+
+    kwargs = {} if args.port is None else {'port': args.port}
+    proxy = SerialProxy(**kwargs)
+    df_trace = read_trace(proxy)
+
+    output = sys.stdout if args.output == '-' else open(args.output, 'w')
+    try:
+        if args.format == 'csv':
+            df_trace.to_csv(output, index=False)
+        else:
+            json.dump(to_chrome_trace(df_trace), output)
+    finally:
+        if output is not sys.stdout:
+            output.close()
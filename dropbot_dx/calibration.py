@@ -0,0 +1,141 @@
+'''
+High-voltage output calibration.
+
+The firmware converts a target voltage to a digital potentiometer code using
+a table of the output voltage at each code.  By default, the table is
+computed from the ideal voltage divider model (see the `R7` and `pot_max`
+config fields).  A measured correction table may be stored in the
+`voltage_calibration` config field, in which case the firmware interpolates
+between the measured points instead.
+
+Example:
+
+    from dropbot_dx import SerialProxy
+    from dropbot_dx.calibration import (measure_voltage_calibration,
+                                        fit_voltage_calibration)
+
+    proxy = SerialProxy()
+    df_measured = measure_voltage_calibration(proxy)
+    proxy.voltage_calibration = fit_voltage_calibration(df_measured)
+    proxy.save_config()
+'''
+import time
+
+import numpy as np
+import pandas as pd
+
+#: Maximum number of calibration points (see `config.options`).
+MAX_CALIBRATION_POINTS = 16
+#: Number of digital potentiometer codes.
+POT_CODES = 256
+
+
+def measure_voltage_calibration(proxy, n_points=20, settle_s=.5):
+    '''
+    Measure the high-voltage output at a range of potentiometer codes.
+
+    The calibration stored on the device is cleared first, so that target
+    voltages are converted to codes using the ideal model.
+
+    Parameters
+    ----------
+    proxy : dropbot_dx.proxy.ProxyMixin
+    n_points : int, optional
+        Number of target voltages between the minimum and maximum voltage.
+    settle_s : float, optional
+        Time to wait after each voltage change before measuring.
+
+    Returns
+    -------
+    pandas.DataFrame
+        Table with the columns ``code``, ``target_voltage`` and
+        ``measured_voltage``.
+    '''
+    proxy.update_config(voltage_calibration='')
+
+    hv_output_enabled = proxy.hv_output_enabled
+    original_voltage = proxy.voltage
+    rows = []
+    try:
+        proxy.voltage = proxy.min_waveform_voltage
+        proxy.hv_output_enabled = True
+        for voltage in np.linspace(proxy.min_waveform_voltage,
+                                   proxy.max_waveform_voltage, n_points):
+            proxy.voltage = voltage
+            time.sleep(settle_s)
+            rows.append((proxy.pot_code(), voltage, proxy.measured_voltage))
+    finally:
+        proxy.voltage = original_voltage
+        proxy.hv_output_enabled = hv_output_enabled
+    return pd.DataFrame(rows, columns=['code', 'target_voltage',
+                                       'measured_voltage'])
+
+
+def fit_voltage_calibration(df_measured, n_points=MAX_CALIBRATION_POINTS):
+    '''
+    Reduce measurements to a piecewise linear calibration table.
+
+    Parameters
+    ----------
+    df_measured : pandas.DataFrame
+        Table with ``code`` and ``measured_voltage`` columns (e.g., from
+        :func:`measure_voltage_calibration`).  Repeated codes are averaged.
+    n_points : int, optional
+        Number of calibration points (at most
+        :data:`MAX_CALIBRATION_POINTS`).
+
+    Returns
+    -------
+    pandas.DataFrame
+        Table with ``code`` and ``voltage`` columns, with increasing codes.
+    '''
+    if not 2 <= n_points <= MAX_CALIBRATION_POINTS:
+        raise ValueError('Number of points must be between 2 and %d.' %
+                         MAX_CALIBRATION_POINTS)
+    measured = (df_measured.groupby('code')['measured_voltage'].mean()
+                .sort_index())
+    if measured.shape[0] < 2:
+        raise ValueError('At least two distinct codes must be measured.')
+    # Keep evenly spaced measurements (including the first and last).
+    index = np.unique(np.round(np.linspace(0, measured.shape[0] - 1,
+                                           min(n_points, measured.shape[0])))
+                      .astype(int))
+    measured = measured.iloc[index]
+    return pd.DataFrame({'code': measured.index.values.astype(int),
+                         'voltage': measured.values},
+                        columns=['code', 'voltage'])
+
+
+def pack_voltage_calibration(df_calibration):
+    '''
+    Returns
+    -------
+    str
+        Calibration table encoded for the `voltage_calibration` config field.
+    '''
+    if df_calibration.shape[0] > MAX_CALIBRATION_POINTS:
+        raise ValueError('At most %d calibration points are supported.' %
+                         MAX_CALIBRATION_POINTS)
+    codes = df_calibration['code'].values
+    if (np.diff(codes) <= 0).any() or codes.min() < 0 or codes.max() >= \
+            POT_CODES:
+        raise ValueError('Codes must be increasing and between 0 and %d.' %
+                         (POT_CODES - 1))
+    points = np.empty((df_calibration.shape[0], 2), dtype='<u2')
+    points[:, 0] = codes
+    points[:, 1] = np.round(100 * df_calibration['voltage'].values)
+    return points.tostring()
+
+
+def unpack_voltage_calibration(data):
+    '''
+    Returns
+    -------
+    pandas.DataFrame
+        Table with ``code`` and ``voltage`` columns, decoded from the
+        `voltage_calibration` config field.
+    '''
+    points = np.fromstring(data, dtype='<u2').reshape(-1, 2)
+    return pd.DataFrame({'code': points[:, 0].astype(int),
+                         'voltage': 1e-2 * points[:, 1]},
+                        columns=['code', 'voltage'])
@@ -0,0 +1,357 @@
+'''
+Asynchronous logging of timestamped records to an HDF5 file.
+
+Records are queued in memory by the caller (e.g., the control thread), and
+appended to chunked, compressed HDF5 datasets by a background writer thread,
+so disk stalls do not delay the caller.
+
+Example:
+
+    from dropbot_dx import SerialProxy
+    from dropbot_dx.data_logger import DataLogger
+
+    proxy = SerialProxy()
+    with DataLogger('experiment.h5') as logger:
+        for i in range(100):
+            proxy.state_of_channels = ...
+            logger.log_state(proxy)
+            logger.log('measurements', voltage=proxy.measured_voltage)
+        print(logger.statistics)
+
+Each dataset is a one-dimensional array of records, with a ``timestamp``
+field (seconds since the epoch) followed by the logged fields.  Datasets are
+created by the first record logged to them, and all later records must have
+the same fields (fields may be scalars or fixed-size arrays).  The datasets
+may be read with, e.g., ``pandas.DataFrame(h5py.File(path)['measurements'][:])``
+(for scalar fields).
+'''
+import threading
+import time
+try:
+    import Queue as queue
+except ImportError:
+    import queue
+
+import h5py
+import numpy as np
+
+
+class DataLogger(object):
+    '''
+    Parameters
+    ----------
+    path : str
+        HDF5 output file (appended to if it exists).
+    max_queued : int, optional
+        Maximum number of queue entries (each a record, or a block of records
+        queued by :meth:`log_records`).
+    block : bool, optional
+        If ``True``, wait (up to ``timeout_s``) for space in the queue when it
+        is full (*backpressure*).  Otherwise (or on timeout), the record is
+        dropped.
+    timeout_s : float, optional
+        Maximum time to wait for space in the queue (``None`` to wait
+        indefinitely).
+    chunk_rows : int, optional
+        Number of records per HDF5 chunk.
+    compression : str, optional
+        HDF5 compression filter (e.g., ``'gzip'``, ``'lzf'``, or ``None``).
+    compression_opts : int, optional
+        Compression level (``gzip`` only).
+    flush_interval_s : float, optional
+        Maximum time between flushes of the HDF5 file to disk.
+    '''
+    def __init__(self, path, max_queued=100000, block=False, timeout_s=1.,
+                 chunk_rows=4096, compression='gzip', compression_opts=4,
+                 flush_interval_s=1.):
+        self.path = path
+        self.block = block
+        self.timeout_s = timeout_s
+        self.chunk_rows = chunk_rows
+        self.compression = compression
+        self.compression_opts = (compression_opts if compression == 'gzip'
+                                 else None)
+        self.flush_interval_s = flush_interval_s
+
+        self._queue = queue.Queue(maxsize=max_queued)
+        self._lock = threading.Lock()
+        self._stats = dict.fromkeys(['queued', 'written', 'dropped',
+                                     'max_queue_depth', 'blocked_s',
+                                     'write_s', 'batches'], 0)
+        self._fields = {}
+        self._error = None
+        self._closed = False
+        self._h5_file = h5py.File(path, 'a')
+        self._thread = threading.Thread(target=self._write_loop,
+                                        name='DataLogger(%s)' % path)
+        self._thread.daemon = True
+        self._thread.start()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def log(self, dataset, timestamp=None, **fields):
+        '''
+        Queue a record.
+
+        Parameters
+        ----------
+        dataset : str
+            Name of HDF5 dataset to append the record to.
+        timestamp : float, optional
+            Record time (default: now, as returned by :func:`time.time`).
+        **fields
+            Field values (scalars or fixed-size arrays).
+
+        Returns
+        -------
+        bool
+            ``True`` if the record was queued, ``False`` if it was dropped.
+        '''
+        if timestamp is None:
+            timestamp = time.time()
+        names = self._fields.setdefault(dataset, sorted(fields))
+        if len(names) != len(fields) or any(name not in fields
+                                            for name in names):
+            raise ValueError('Fields of record do not match previous records '
+                             'of dataset `%s`: %s' % (dataset, names))
+        return self._put((dataset, timestamp, fields))
+
+    def log_records(self, dataset, records):
+        '''
+        Queue a block of records as a single queue entry (e.g., a block of
+        samples read from the device).
+
+        Parameters
+        ----------
+        dataset : str
+            Name of HDF5 dataset to append the records to.
+        records : numpy.ndarray
+            Structured array, including a ``timestamp`` field.
+
+        Returns
+        -------
+        bool
+            ``True`` if the records were queued, ``False`` if they were
+            dropped.
+        '''
+        records = np.asarray(records)
+        if records.dtype.names is None or 'timestamp' not in \
+                records.dtype.names:
+            raise ValueError('Records must be a structured array with a '
+                             '`timestamp` field.')
+        return self._put((dataset, None, records))
+
+    def log_state(self, proxy, dataset='state'):
+        '''
+        Queue a record of the channel states (one ``uint8`` per channel),
+        voltage, frequency and high-voltage output state of a device.
+
+        Parameters
+        ----------
+        proxy : dropbot_dx.proxy.ProxyMixin
+        dataset : str, optional
+            Name of HDF5 dataset to append the record to.
+        '''
+        timestamp = time.time()
+        state = proxy.state
+        return self.log(dataset, timestamp=timestamp,
+                        state_of_channels=np.asarray(proxy.state_of_channels,
+                                                     dtype='uint8'),
+                        voltage=state['voltage'],
+                        frequency=state['frequency'],
+                        hv_output_enabled=bool(state['hv_output_enabled']))
+
+    @property
+    def statistics(self):
+        '''
+        Returns
+        -------
+        pandas.Series
+            Number of records queued, written and dropped (queue full, or
+            records that could not be written to their dataset),
+            current and maximum queue depth (in queue entries), total time
+            callers were blocked waiting for space in the queue and time
+            spent writing (seconds), and number of write batches.
+        '''
+        import pandas as pd
+
+        with self._lock:
+            stats = dict(self._stats)
+        stats['queue_depth'] = self._queue.qsize()
+        return pd.Series(stats, index=['queued', 'written', 'dropped',
+                                       'queue_depth', 'max_queue_depth',
+                                       'blocked_s', 'write_s', 'batches'])
+
+    def close(self):
+        '''
+        Write all queued records, and close the HDF5 file.
+
+        Raises
+        ------
+        Exception
+            If writing failed (exception raised by the writer thread).
+        '''
+        if not self._closed:
+            self._closed = True
+            self._queue.put(None)
+            self._thread.join()
+        self._raise_error()
+
+    def _raise_error(self):
+        if self._error is not None:
+            error, self._error = self._error, None
+            raise error
+
+    def _put(self, item):
+        self._raise_error()
+        if self._closed:
+            raise IOError('Logger is closed.')
+        count = 1 if item[1] is not None else item[2].size
+        start = time.time()
+        try:
+            if self.block:
+                self._queue.put(item, timeout=self.timeout_s)
+            else:
+                self._queue.put_nowait(item)
+            queued = True
+        except queue.Full:
+            queued = False
+        with self._lock:
+            if self.block:
+                self._stats['blocked_s'] += time.time() - start
+            if queued:
+                self._stats['queued'] += count
+                self._stats['max_queue_depth'] = \
+                    max(self._stats['max_queue_depth'], self._queue.qsize())
+            else:
+                self._stats['dropped'] += count
+        return queued
+
+    def _write_loop(self):
+        last_flush = time.time()
+        done = False
+        try:
+            while not done:
+                try:
+                    items = [self._queue.get(timeout=self.flush_interval_s)]
+                except queue.Empty:
+                    items = []
+                # Drain everything queued so far, so records are written in
+                # batches (one resize/write per dataset).
+                while True:
+                    try:
+                        items.append(self._queue.get_nowait())
+                    except queue.Empty:
+                        break
+                if None in items:
+                    done = True
+                    items = [item for item in items if item is not None]
+                if items:
+                    self._write_batch(items)
+                if done or time.time() - last_flush >= self.flush_interval_s:
+                    self._h5_file.flush()
+                    last_flush = time.time()
+        except Exception as exception:
+            self._error = exception
+            # Keep draining, so callers blocked on a full queue are released.
+            while not done:
+                done = self._queue.get() is None
+        finally:
+            self._h5_file.close()
+
+    def _write_batch(self, items):
+        start = time.time()
+        batches = {}
+        for dataset, timestamp, record in items:
+            batches.setdefault(dataset, []).append((timestamp, record))
+
+        count = 0
+        dropped = 0
+        error = None
+        for dataset, records in batches.items():
+            # Each dataset is written separately, so records that cannot be
+            # written (e.g., fields that do not match the dataset) only cost
+            # the records of their own dataset.
+            try:
+                blocks = []
+                fields = []
+                for timestamp, record in records:
+                    if timestamp is None:
+                        # Block of records (see `log_records()`).
+                        if fields:
+                            blocks.append(self._to_records(fields))
+                            fields = []
+                        blocks.append(record)
+                    else:
+                        fields.append((timestamp, record))
+                if fields:
+                    blocks.append(self._to_records(fields))
+                data = (np.concatenate(blocks) if len(blocks) > 1
+                        else blocks[0])
+                self._append(dataset, data)
+                count += data.size
+            except ValueError as exception:
+                dropped += sum(1 if timestamp is not None else record.size
+                               for timestamp, record in records)
+                error = exception
+
+        with self._lock:
+            self._stats['written'] += count
+            self._stats['dropped'] += dropped
+            self._stats['write_s'] += time.time() - start
+            self._stats['batches'] += 1
+        if error is not None:
+            # Reported to the caller (see `_raise_error()`), without stopping
+            # the writer.
+            self._error = error
+
+    def _to_records(self, fields):
+        '''
+        Parameters
+        ----------
+        fields : list
+            List of ``(timestamp, fields)`` tuples, all with the same field
+            names.
+
+        Returns
+        -------
+        numpy.ndarray
+            Structured array with ``timestamp`` field, followed by the fields
+            (in sorted order).
+        '''
+        names = sorted(fields[0][1])
+        columns = [np.array([timestamp for timestamp, values_i in fields],
+                            dtype='float64')]
+        for name in names:
+            columns.append(np.array([values_i[name]
+                                     for timestamp, values_i in fields]))
+        dtype = [('timestamp', 'float64')]
+        for name, column in zip(names, columns[1:]):
+            if column.dtype == bool:
+                column = column.astype('uint8')
+            dtype.append((str(name), column.dtype, column.shape[1:]))
+        records = np.empty(len(fields), dtype=dtype)
+        records['timestamp'] = columns[0]
+        for name, column in zip(names, columns[1:]):
+            records[name] = column
+        return records
+
+    def _append(self, name, data):
+        if name not in self._h5_file:
+            self._h5_file.create_dataset(name, shape=(0, ), maxshape=(None, ),
+                                         dtype=data.dtype,
+                                         chunks=(self.chunk_rows, ),
+                                         compression=self.compression,
+                                         compression_opts=
+                                         self.compression_opts)
+        dataset = self._h5_file[name]
+        if dataset.dtype.names != data.dtype.names:
+            raise ValueError('Fields of records do not match dataset `%s`.'
+                             % name)
+        start = dataset.shape[0]
+        dataset.resize((start + data.size, ))
+        dataset[start:] = data.astype(dataset.dtype)
@@ -0,0 +1,339 @@
+'''
+Concurrent control of several DropBot DX devices.
+
+Each device in a :class:`DeviceGroup` has its own I/O worker thread, so
+commands broadcast to the group are sent to all devices in parallel.
+
+Example:
+
+    from dropbot_dx import SerialProxy, serial_ports
+    from dropbot_dx.device_group import DeviceGroup
+
+    group = DeviceGroup([SerialProxy(port=port)
+                         for port in serial_ports().index])
+    group.call('update_state', voltage=100)
+    group.upload_actuation_program([(500, states_a), (500, states_b)])
+    df_start = group.synchronized_start(delay_s=.1)
+
+:class:`dropbot_dx.simulator.SimulatedProxy` instances may be used in place
+of devices (e.g., for testing).
+'''
+from collections import OrderedDict
+import threading
+import time
+try:
+    import Queue as queue
+except ImportError:
+    import queue
+
+import numpy as np
+import pandas as pd
+
+#: Actuation program states (see `ActuationProgram` in
+#: `src/ActuationProgram.h`).
+PROGRAM_STATES = {0: 'idle', 1: 'armed', 2: 'running', 3: 'complete',
+                  4: 'error'}
+
+
+def pack_actuation_program(steps):
+    '''
+    Parameters
+    ----------
+    steps : list
+        List of ``(duration_ms, states)`` tuples, where ``states`` has one
+        entry (0 or 1) per channel.
+
+    Returns
+    -------
+    numpy.ndarray
+        Program in the format of the ``set_actuation_program`` command
+        (``uint8``).
+    '''
+    data = []
+    for duration_ms, states in steps:
+        data.append(np.array([duration_ms], dtype='<u4').view('uint8'))
+        data.append(np.packbits(np.asarray(states).astype(int)[::-1])[::-1])
+    return np.concatenate(data).astype('uint8')
+
+
+def unpack_actuation_program(data, number_of_channels):
+    '''
+    Inverse of :func:`pack_actuation_program`.
+    '''
+    data = np.asarray(data, dtype='uint8')
+    step_size = 4 + number_of_channels // 8
+    steps = []
+    for offset in range(0, data.size - step_size + 1, step_size):
+        duration_ms = int(data[offset:offset + 4].view('<u4')[0])
+        states = np.unpackbits(data[offset + 4:offset + step_size]
+                               [::-1])[::-1]
+        steps.append((duration_ms, states))
+    return steps
+
+
+class DeviceGroupError(Exception):
+    '''
+    Raised when a command fails on one or more devices.
+
+    Attributes
+    ----------
+    results : collections.OrderedDict
+        Result of each device the command succeeded on.
+    errors : collections.OrderedDict
+        Exception raised by each device the command failed on.
+    '''
+    def __init__(self, results, errors):
+        self.results = results
+        self.errors = errors
+        super(DeviceGroupError, self).__init__(
+            'Command failed on %d device(s): %s' %
+            (len(errors), ', '.join('%s: %s' % (name, error)
+                                    for name, error in errors.items())))
+
+
+class _Future(object):
+    def __init__(self):
+        self._event = threading.Event()
+        self._result = None
+        self._error = None
+
+    def set_result(self, result):
+        self._result = result
+        self._event.set()
+
+    def set_error(self, error):
+        self._error = error
+        self._event.set()
+
+    def result(self, timeout=None):
+        if not self._event.wait(timeout):
+            raise IOError('Timed out waiting for device.')
+        if self._error is not None:
+            raise self._error
+        return self._result
+
+
+class _Worker(object):
+    '''
+    Thread that runs all I/O for one device, in the order it is submitted.
+    '''
+    def __init__(self, name, proxy):
+        self.proxy = proxy
+        self._queue = queue.Queue()
+        self._thread = threading.Thread(target=self._run,
+                                        name='DeviceGroup(%s)' % name)
+        self._thread.daemon = True
+        self._thread.start()
+
+    def submit(self, func, *args, **kwargs):
+        future = _Future()
+        self._queue.put((future, func, args, kwargs))
+        return future
+
+    def close(self):
+        self._queue.put(None)
+        self._thread.join()
+
+    def _run(self):
+        while True:
+            item = self._queue.get()
+            if item is None:
+                break
+            future, func, args, kwargs = item
+            try:
+                future.set_result(func(self.proxy, *args, **kwargs))
+            except Exception as exception:
+                future.set_error(exception)
+
+
+class DeviceGroup(object):
+    '''
+    Parameters
+    ----------
+    proxies : list or dict
+        Device proxies (e.g., :class:`dropbot_dx.proxy.SerialProxy`), indexed
+        by name if a ``dict`` is given (otherwise, by position).
+    timeout_s : float, optional
+        Maximum time to wait for each command on each device.
+    '''
+    def __init__(self, proxies, timeout_s=10.):
+        if not isinstance(proxies, dict):
+            proxies = OrderedDict(enumerate(proxies))
+        self.proxies = OrderedDict(proxies)
+        self.timeout_s = timeout_s
+        self._workers = OrderedDict((name, _Worker(name, proxy))
+                                    for name, proxy in self.proxies.items())
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __len__(self):
+        return len(self.proxies)
+
+    def close(self):
+        '''
+        Stop the worker threads (proxies are not closed).
+        '''
+        for worker in self._workers.values():
+            worker.close()
+        self._workers.clear()
+
+    def map(self, func, *args, **kwargs):
+        '''
+        Call ``func(proxy, *args, **kwargs)`` for every device in parallel
+        (each on its device's worker thread).
+
+        Returns
+        -------
+        collections.OrderedDict
+            Result for each device, by name.
+
+        Raises
+        ------
+        DeviceGroupError
+            If ``func`` raised an exception for any device (after all calls
+            have completed).
+        '''
+        futures = OrderedDict((name, worker.submit(func, *args, **kwargs))
+                              for name, worker in self._workers.items())
+        results = OrderedDict()
+        errors = OrderedDict()
+        for name, future in futures.items():
+            try:
+                results[name] = future.result(self.timeout_s)
+            except Exception as exception:
+                errors[name] = exception
+        if errors:
+            raise DeviceGroupError(results, errors)
+        return results
+
+    def call(self, method, *args, **kwargs):
+        '''
+        Broadcast ``proxy.<method>(*args, **kwargs)`` to all devices.
+
+        Returns
+        -------
+        pandas.Series
+            Result for each device, indexed by device name.
+        '''
+        results = self.map(lambda proxy: getattr(proxy, method)(*args,
+                                                                **kwargs))
+        return pd.Series(list(results.values()), index=list(results.keys()),
+                         name=method)
+
+    def clock_offsets(self, n_samples=10):
+        '''
+        Estimate the offset of each device clock (``microseconds()``) from
+        the host clock.
+
+        Each estimate uses the request with the shortest round trip, assuming
+        the device read its clock half way through the round trip.
+
+        Returns
+        -------
+        pandas.DataFrame
+            Table indexed by device name, with ``offset_us`` (device clock
+            minus host clock, modulo ``2 ** 32``) and ``uncertainty_us`` (half
+            the shortest round trip time).
+        '''
+        def measure(proxy):
+            best = None
+            for i in range(n_samples):
+                start = time.time()
+                device_us = int(proxy.microseconds())
+                end = time.time()
+                if best is None or end - start < best[1] - best[0]:
+                    best = (start, end, device_us)
+            start, end, device_us = best
+            host_us = int(round(.5 * (start + end) * 1e6))
+            return ((device_us - host_us) & 0xFFFFFFFF,
+                    .5 * (end - start) * 1e6)
+
+        results = self.map(measure)
+        return pd.DataFrame(list(results.values()),
+                            index=list(results.keys()),
+                            columns=['offset_us', 'uncertainty_us'])
+
+    def upload_actuation_program(self, steps):
+        '''
+        Load the same actuation program on all devices.
+
+        Parameters
+        ----------
+        steps : list
+            List of ``(duration_ms, states)`` tuples (see
+            :func:`pack_actuation_program`).
+        '''
+        data = pack_actuation_program(steps)
+        results = self.map(lambda proxy: proxy.set_actuation_program(data))
+        failed = [name for name, ok in results.items() if not ok]
+        if failed:
+            raise ValueError('Error loading program on device(s) %s.  Check '
+                             'number of states matches channel count, and '
+                             'no program is running.' % failed)
+
+    def synchronized_start(self, delay_s=.1, n_samples=10):
+        '''
+        Start the loaded actuation program on all devices at the same time.
+
+        Clock offsets are measured (see :meth:`clock_offsets`), and each
+        device is asked to start at the device time corresponding to
+        ``delay_s`` from now.
+
+        Returns
+        -------
+        pandas.DataFrame
+            Table indexed by device name, with ``start_us`` (requested start
+            in device time), ``offset_us``, and ``uncertainty_us`` (bound on
+            the start time error of each device, relative to the host clock;
+            the skew between two devices is at most the sum of their
+            uncertainties).
+        '''
+        df_offsets = self.clock_offsets(n_samples=n_samples)
+        start_host_us = int(round((time.time() + delay_s) * 1e6))
+        df_start = df_offsets.copy()
+        df_start.insert(0, 'start_us', (start_host_us +
+                                        df_offsets.offset_us)
+                        .astype('int64') & 0xFFFFFFFF)
+        start_us = df_start.start_us.to_dict()
+
+        results = self.map(lambda proxy:
+                           proxy.start_actuation_program_at(
+                               int(start_us[self._name(proxy)])))
+        failed = [name for name, ok in results.items() if not ok]
+        if failed:
+            raise IOError('Start time already passed (or no program loaded, '
+                          'or channel count changed) on device(s) %s.  Try a '
+                          'longer delay.' % failed)
+        return df_start
+
+    def actuation_program_status(self):
+        '''
+        Returns
+        -------
+        pandas.DataFrame
+            Program state, step, number of steps, requested and actual start
+            time (device ``microseconds()``), and start error
+            (``late_us``) of each device.
+        '''
+        results = self.map(lambda proxy: list(proxy
+                                              .actuation_program_status()))
+        df_status = pd.DataFrame(np.array(list(results.values()),
+                                          dtype='int64'),
+                                 index=list(results.keys()),
+                                 columns=['state', 'step', 'steps',
+                                          'start_us', 'actual_start_us'])
+        df_status['late_us'] = ((df_status.actual_start_us -
+                                 df_status.start_us) & 0xFFFFFFFF)
+        df_status.loc[df_status.late_us >= 2 ** 31, 'late_us'] -= 2 ** 32
+        df_status['state'] = df_status.state.map(PROGRAM_STATES)
+        return df_status
+
+    def _name(self, proxy):
+        for name, proxy_i in self.proxies.items():
+            if proxy_i is proxy:
+                return name
+        raise KeyError(proxy)
@@ -0,0 +1,159 @@
+'''
+Host reference implementation of the on-device streaming filter (see
+`FilterPipeline` in `src/FilterPipeline.h`).
+
+The device filters raw ADC samples with a CIC decimator followed by a Q15 FIR
+filter, using integer arithmetic.  :func:`filter_reference` implements the
+same arithmetic, so for the same input, settings and coefficients, its output
+matches the device output exactly.
+
+Example:
+
+    import numpy as np
+    from dropbot_dx import SerialProxy
+    from dropbot_dx.filters import design_lowpass, filter_reference
+
+    proxy = SerialProxy()
+    coefficients = design_lowpass(31, .1)
+    proxy.configure_streaming_filter(coefficients, cic_stages=3, cic_shift=3)
+    samples = np.random.randint(0, 4096, size=1000).astype('uint16')
+    assert (proxy.filter_samples(samples) ==
+            filter_reference(samples, coefficients, cic_stages=3,
+                             cic_shift=3)).all()
+'''
+import numpy as np
+
+#: Maximum number of FIR coefficients (see `FILTER_MAX_TAPS`).
+MAX_TAPS = 64
+#: Maximum number of CIC stages.
+MAX_CIC_STAGES = 4
+
+
+def _wrap_int32(values):
+    '''
+    Returns
+    -------
+    numpy.ndarray
+        Values modulo ``2 ** 32``, as two's complement ``int32``.
+    '''
+    return ((np.asarray(values, dtype='int64') & 0xFFFFFFFF)
+            .astype('uint32').view('int32'))
+
+
+def to_q15(coefficients):
+    '''
+    Parameters
+    ----------
+    coefficients : array-like
+        Coefficients in the range ``[-1, 1)``, or ``int16`` Q15 coefficients
+        (returned unchanged).
+
+    Returns
+    -------
+    numpy.ndarray
+        Coefficients in Q15 format (``int16``), saturated.
+    '''
+    coefficients = np.asarray(coefficients)
+    if coefficients.dtype == 'int16':
+        return coefficients
+    return np.clip(np.round(coefficients * 2 ** 15), -2 ** 15,
+                   2 ** 15 - 1).astype('int16')
+
+
+def design_lowpass(n_taps, cutoff):
+    '''
+    Design a windowed-sinc (Hamming) low-pass FIR filter with unity DC gain.
+
+    Parameters
+    ----------
+    n_taps : int
+        Number of taps (at most :data:`MAX_TAPS`).
+    cutoff : float
+        Cutoff frequency, relative to the FIR input sample rate (0-0.5).
+
+    Returns
+    -------
+    numpy.ndarray
+        Q15 coefficients (``int16``).
+    '''
+    if not 0 < n_taps <= MAX_TAPS:
+        raise ValueError('Number of taps must be 1-%d.' % MAX_TAPS)
+    n = np.arange(n_taps) - .5 * (n_taps - 1)
+    taps = np.sinc(2 * cutoff * n) * np.hamming(n_taps)
+    return to_q15(taps / taps.sum())
+
+
+def cic_decimate(samples, stages=1, shift=0, offset=0):
+    '''
+    Parameters
+    ----------
+    samples : array-like
+        Raw ADC values (``uint16``).
+    stages : int, optional
+        Number of integrator/comb stages.
+    shift : int, optional
+        Decimation ratio is ``2 ** shift``.
+    offset : int, optional
+        Subtracted from each sample.
+
+    Returns
+    -------
+    numpy.ndarray
+        Decimated samples (``int16``), divided by the CIC gain.
+    '''
+    if not 1 <= stages <= MAX_CIC_STAGES or stages * shift > 15:
+        raise ValueError('CIC stages must be 1-%d, and stages * shift at '
+                         'most 15.' % MAX_CIC_STAGES)
+    decimation = 1 << shift
+    values = np.asarray(samples, dtype='uint16').astype('int64') - offset
+    for i in range(stages):
+        values = np.cumsum(values) & 0xFFFFFFFF
+    values = values[decimation - 1::decimation]
+    for i in range(stages):
+        values = (values - np.concatenate([[0], values[:-1]])) & 0xFFFFFFFF
+    return np.clip(_wrap_int32(values) >> (stages * shift), -2 ** 15,
+                   2 ** 15 - 1).astype('int16')
+
+
+def fir_q15(samples, coefficients, decimation=1):
+    '''
+    Parameters
+    ----------
+    samples : array-like
+        Input samples (``int16``).
+    coefficients : array-like
+        Q15 coefficients (see :func:`to_q15`).
+    decimation : int, optional
+        Output every ``decimation``-th filtered sample.
+
+    Returns
+    -------
+    numpy.ndarray
+        Filtered samples (``int16``), rounded from Q30 and saturated.
+    '''
+    samples = np.asarray(samples, dtype='int16').astype('int64')
+    coefficients = to_q15(coefficients).astype('int64')
+    if not samples.size:
+        return np.zeros(0, dtype='int16')
+    accumulated = _wrap_int32(np.convolve(samples, coefficients)
+                              [:samples.size])
+    accumulated = accumulated[decimation - 1::decimation]
+    return np.clip(_wrap_int32(accumulated.astype('int64') + (1 << 14)) >> 15,
+                   -2 ** 15, 2 ** 15 - 1).astype('int16')
+
+
+def filter_reference(samples, coefficients, cic_stages=1, cic_shift=0,
+                     fir_decimation=1, offset=0):
+    '''
+    Filter raw ADC samples exactly as the device does, starting from the
+    initial (zero) filter state.
+
+    See :func:`cic_decimate` and :func:`fir_q15` for parameters.
+
+    Returns
+    -------
+    numpy.ndarray
+        Filtered samples (``int16``).
+    '''
+    return fir_q15(cic_decimate(samples, cic_stages, cic_shift, offset),
+                   coefficients, fir_decimation)
@@ -1,3 +1,4 @@
+import json
 import time
 import uuid
 
@@ -27,6 +28,37 @@ def serial_ports():
     return df_teensy_comports
 
 
+#: Default location of the cached map from serial port to device UUID (see
+#: :class:`SerialProxy`).
+PORT_CACHE_PATH = path('~').expand().joinpath('.dropbot-dx', 'ports.json')
+#: Boot phases (see `boot_phase_t` in `src/Node.h`).
+BOOT_PHASES = ['pins', 'config', 'timer1', 'state', 'serial', 'i2c', 'servo',
+               'adc', 'switching_boards']
+
+
+def load_port_cache(cache_path=PORT_CACHE_PATH):
+    '''
+    Returns
+    -------
+    dict
+        Map from serial port to device UUID (string) of the devices last
+        connected on each port (empty if there is no cache).
+    '''
+    try:
+        with open(cache_path, 'r') as input_:
+            return json.load(input_)
+    except (IOError, OSError, ValueError):
+        return {}
+
+
+def save_port_cache(port_uuids, cache_path=PORT_CACHE_PATH):
+    cache_path = path(cache_path)
+    if not cache_path.parent.isdir():
+        cache_path.parent.makedirs_p()
+    with open(cache_path, 'w') as output:
+        json.dump(port_uuids, output, indent=2, sort_keys=True)
+
+
 try:
     from base_node_rpc.proxy import ConfigMixinBase, StateMixinBase
     from .node import (Proxy as _Proxy, I2cProxy as _I2cProxy,
@@ -56,11 +88,6 @@ try:
 
         def __init__(self, *args, **kwargs):
             super(ProxyMixin, self).__init__(*args, **kwargs)
-            # can't access i2c bus if the control board is connected, so for now, need to explicitly initialize
-            # switching boards (e.g., from the dropbot-dx plugin)
-            #
-            # # embeded version isn't working with teensy. Use this for now:
-            # #self.initialize_switching_boards()
 
         def __del__(self):
             try:
@@ -70,23 +97,76 @@ try:
                 pass
             super(ProxyMixin, self).__del__()
 
-        def get_environment_state(self, i2c_address=0x27):
+        def update_state(self, **kwargs):
+            '''
+            Apply a state update as a single transaction on the device.
+
+            All fields are validated before any is applied, and changed
+            fields are committed to the hardware once, in a fixed order.
+
+            The high-voltage soft-start (if ``hv_output_enabled`` changes to
+            ``True``) runs after all other fields have been applied.
+
+            Raises
+            ------
+            ValueError
+                If any field was rejected (in which case no field was
+                applied).
+            IOError
+                If the high-voltage soft-start was interrupted by another
+                command (in which case all other fields were applied, and the
+                output was left disabled).
+            '''
+            state = self.state_class(**kwargs)
+            rejected = self.apply_state(state.SerializeToString())
+            if rejected & 0x80000000:
+                raise ValueError('Error decoding state.')
+            elif rejected & 0x40000000:
+                raise IOError('High-voltage soft-start interrupted; output '
+                              'left disabled.')
+            elif rejected:
+                fields = [field.name for field in state.DESCRIPTOR.fields
+                          if rejected & (1 << (field.number - 1))]
+                raise ValueError('State field(s) rejected: %s' %
+                                 ', '.join(fields))
+            return True
+
+        def get_environment_state(self, i2c_address=None):
             '''
             Acquire temperature and humidity from Honeywell HIH6000 series
             sensor.
 
+            If background sampling is enabled on the device (see the
+            ``environment_sensor_period_ms`` config field), the most recent
+            sample is returned immediately.  Otherwise, a measurement is
+            triggered and polled over RPC.
+
             [1]: http://sensing.honeywell.com/index.php/ci_id/142171/la_id/1/document/1/re_id/0
             '''
             import pandas as pd
 
+            config = self.config
+            if (config['environment_sensor_period_ms'] > 0 and
+                    i2c_address in (None, config['environment_sensor_i2c_address'])):
+                state = np.asarray(self.environment_state())
+                if not np.isnan(state[:2]).any():
+                    return pd.Series(state[:2],
+                                     index=['relative_humidity',
+                                            'temperature_celsius'])
+            if i2c_address is None:
+                i2c_address = config['environment_sensor_i2c_address']
+
             # Trigger measurement.
             self.i2c_write(i2c_address, [])
             time.sleep(.01)
 
             while True:
                 # Read 4 bytes from sensor.
-                humidity_data, temperature_data = self.i2c_read(i2c_address,
-                                                                4).view('>u2')
+                data = np.asarray(self.i2c_read(i2c_address, 4),
+                                  dtype='uint8')
+                if data.size != 4:
+                    raise IOError('No response from sensor.')
+                humidity_data, temperature_data = data.view('>u2')
                 status_code = (humidity_data >> 14) & 0x03
                 if status_code == 0:
                     # Measurement completed successfully.
@@ -114,13 +194,47 @@ try:
         def magnet_engaged(self, value):
             self.update_state(magnet_engaged=value)
 
-        def pulse_magnet(self, pulse_time_ms=600, n_pulses=3):
-            state = self.magnet_engaged
-            for i in range(n_pulses):
-                self.magnet_engaged = not state
-                time.sleep(pulse_time_ms / 1000.0)
-                self.magnet_engaged = state
-                time.sleep(pulse_time_ms / 1000.0)
+        def pulse_magnet(self, pulse_time_ms=600, n_pulses=3, wait=True,
+                         timeout_s=5.):
+            '''
+            Toggle the magnet ``n_pulses`` times, holding each position for
+            ``pulse_time_ms``.
+
+            Pulses are timed on the device (see the ``servo_velocity`` config
+            field to ramp moves).
+
+            Parameters
+            ----------
+            pulse_time_ms : int, optional
+                Must be at least one servo tick (5 ms by default).
+            n_pulses : int, optional
+            wait : bool, optional
+                If ``True``, block until the pulses are complete.
+            timeout_s : float, optional
+                Maximum time to wait for the final move to complete after the
+                expected end of the pulses.
+
+            Raises
+            ------
+            ValueError
+                If the pulse time is too short, or the servo timer could not
+                be started on the device.
+            IOError
+                If ``wait`` is ``True`` and the pulses did not complete in
+                time.
+            '''
+            if not (super(ProxyMixin, self)
+                    .pulse_magnet(n_pulses, 2 * pulse_time_ms, pulse_time_ms)):
+                raise ValueError('Invalid magnet pulse parameters (or servo '
+                                 'timer unavailable).')
+            if wait:
+                time.sleep(2e-3 * pulse_time_ms * n_pulses)
+                start = time.time()
+                while not self.magnet_motion_complete():
+                    if time.time() - start > timeout_s:
+                        raise IOError('Timed out waiting for magnet pulses '
+                                      'to complete.')
+                    time.sleep(.01)
 
         @property
         def light_intensity(self):
@@ -146,6 +260,241 @@ try:
         def frequency(self, value):
             return self.update_state(frequency=value)
 
+        def frequency_sweep(self, start_frequency, end_frequency, n_points=50,
+                            log_spacing=True, settle_ms=10,
+                            samples_per_point=16, analog_pin=1):
+            '''
+            Step the waveform frequency on the device and sample an analog
+            input at each frequency, in a single RPC.
+
+            Parameters
+            ----------
+            start_frequency, end_frequency : float
+                Sweep range (Hz).  Must be within the configured frequency
+                limits.
+            n_points : int, optional
+                Number of frequencies.
+            log_spacing : bool, optional
+                Space frequencies logarithmically (otherwise, linearly).
+            settle_ms : int, optional
+                Time to wait after each frequency change before sampling.
+            samples_per_point : int, optional
+                Number of analog samples acquired at each frequency.
+            analog_pin : int, optional
+                Analog input to sample (default: high-voltage feedback, as
+                used by :attr:`measured_voltage`).
+
+            Returns
+            -------
+            pandas.DataFrame
+                Table indexed by ``frequency``, with ``mean``, ``std``, ``min``
+                and ``max`` of the analog input (in ADC counts) at each
+                frequency.
+            '''
+            import pandas as pd
+
+            table = (super(ProxyMixin, self)
+                     .frequency_sweep(start_frequency, end_frequency,
+                                      n_points, log_spacing, settle_ms,
+                                      samples_per_point, analog_pin))
+            if not len(table):
+                raise ValueError('Frequency sweep failed.  Check sweep '
+                                 'range is within frequency limits and '
+                                 'table size fits in device buffer.')
+            df_sweep = pd.DataFrame(np.asarray(table).reshape(n_points, -1),
+                                    columns=['frequency', 'mean', 'std', 'min',
+                                             'max'])
+            return df_sweep.set_index('frequency')
+
+        def triggered_capture(self, pin, trigger_value, pre_samples=512,
+                              post_samples=512, greater_than=True,
+                              trigger_pin=None, timeout_s=10.):
+            '''
+            Capture a window of analog samples around a hardware-compare
+            trigger (see :meth:`start_capture`).
+
+            Parameters
+            ----------
+            pin : int
+                Analog input to record (ADC0).
+            trigger_value : int
+                ADC1 compare value (in ADC counts).
+            pre_samples, post_samples : int, optional
+                Samples to capture before/after the trigger (at most 4096 in
+                total).
+            greater_than : bool, optional
+                Trigger when the value rises to greater than or equal to
+                ``trigger_value`` (otherwise, when it falls below it).  The
+                trigger only fires on a crossing, not on a value that is
+                already past ``trigger_value``.
+            trigger_pin : int, optional
+                Analog input compared on ADC1 (default: ``pin``).
+            timeout_s : float, optional
+                Time to wait for the trigger.
+
+            Returns
+            -------
+            pandas.Series
+                Samples indexed by time relative to the trigger (seconds),
+                with the trigger time (device ``micros()``) in the series
+                name.
+            '''
+            import pandas as pd
+
+            if trigger_pin is None:
+                trigger_pin = pin
+            if not self.start_capture(pin, trigger_pin, trigger_value,
+                                      greater_than, pre_samples,
+                                      post_samples):
+                raise ValueError('Invalid capture parameters.')
+            start = time.time()
+            while True:
+                status = np.asarray(self.capture_status())
+                if status[0] == 4:
+                    break
+                elif time.time() - start > timeout_s:
+                    self.stop_capture()
+                    raise IOError('Timed out waiting for trigger.')
+                time.sleep(.01)
+
+            samples = []
+            window = pre_samples + post_samples
+            while len(samples) < window:
+                chunk = self.capture_read(len(samples), window - len(samples))
+                if not len(chunk):
+                    raise IOError('Error reading captured window.')
+                samples.extend(chunk)
+            period_s = status[5] * 1e-9
+            time_s = (np.arange(window) - pre_samples) * period_s
+            return pd.Series(samples, index=pd.Index(time_s, name='time_s'),
+                             name='trigger_us=%d' % status[3])
+
+        def configure_streaming_filter(self, coefficients, cic_stages=1,
+                                       cic_shift=0, fir_decimation=1,
+                                       offset=0):
+            '''
+            Configure the on-device streaming filter (see
+            :mod:`dropbot_dx.filters` for a reference implementation).
+
+            Parameters
+            ----------
+            coefficients : array-like
+                FIR coefficients, in the range ``[-1, 1)`` or as ``int16``
+                Q15 values (at most 64).
+            cic_stages : int, optional
+                Number of CIC decimator stages (1-4).
+            cic_shift : int, optional
+                CIC decimation ratio is ``2 ** cic_shift``
+                (``cic_stages * cic_shift`` must be at most 15).
+            fir_decimation : int, optional
+                Decimation ratio of the FIR filter.
+            offset : int, optional
+                Subtracted from each raw ADC value.
+            '''
+            from .filters import to_q15
+
+            if not self.configure_filter(cic_stages, cic_shift,
+                                         fir_decimation, offset):
+                raise ValueError('Invalid filter settings (or filter is '
+                                 'running).')
+            q15 = to_q15(coefficients).view('uint16')
+            if not self.set_filter_coefficients(q15):
+                raise ValueError('Invalid filter coefficients (or filter is '
+                                 'running).')
+
+        def filter_samples(self, samples):
+            '''
+            Filter raw ADC samples on the device, starting from the initial
+            filter state (not available while streaming).
+
+            Returns
+            -------
+            numpy.ndarray
+                Filtered samples (``int16``).
+            '''
+            samples = np.asarray(samples, dtype='uint16')
+            return np.asarray(super(ProxyMixin, self).filter_samples(samples),
+                              dtype='uint16').view('int16')
+
+        def read_filtered(self):
+            '''
+            Read filtered samples queued since the last read (see
+            :meth:`start_filter`).
+
+            Returns
+            -------
+            numpy.ndarray
+                Filtered samples (``int16``).
+            '''
+            chunks = []
+            while True:
+                chunk = np.asarray(self.filter_read(), dtype='uint16')
+                if not chunk.size:
+                    break
+                chunks.append(chunk.view('int16'))
+            return (np.concatenate(chunks) if chunks
+                    else np.zeros(0, dtype='int16'))
+
+        @property
+        def filter_statistics(self):
+            '''
+            Returns
+            -------
+            pandas.Series
+                Input and output sample rates (Hz), mean filter cost (CPU
+                cycles per input sample), fraction of CPU time spent
+                filtering, number of filtered samples dropped because they
+                were not read in time, and number of times input samples were
+                lost because the filter fell behind the ADC.
+            '''
+            import pandas as pd
+
+            return pd.Series(np.asarray(self.filter_stats()),
+                             index=['input_hz', 'output_hz',
+                                    'cycles_per_sample', 'cpu_fraction',
+                                    'dropped_outputs', 'input_overruns'])
+
+        @property
+        def boot_timings(self):
+            '''
+            Returns
+            -------
+            pandas.DataFrame
+                Time since reset at the end of each boot phase (``end_ms``)
+                and duration of each phase (``duration_ms``).  Phases from
+                ``i2c`` on are run after the serial link is up.
+            '''
+            import pandas as pd
+
+            end_ms = np.asarray(super(ProxyMixin, self).boot_timings(),
+                                dtype=float) * 1e-3
+            df_boot = pd.DataFrame({'end_ms': end_ms},
+                                   index=pd.Index(BOOT_PHASES[:len(end_ms)],
+                                                  name='phase'))
+            df_boot['duration_ms'] = np.diff(np.concatenate([[0], end_ms]))
+            return df_boot
+
+        def upload_actuation_program(self, steps):
+            '''
+            Load a program of timed channel states (see
+            :meth:`start_actuation_program_at`, and
+            :class:`dropbot_dx.device_group.DeviceGroup` to start programs on
+            several devices together).
+
+            Parameters
+            ----------
+            steps : list
+                List of ``(duration_ms, states)`` tuples, where ``states`` has
+                one entry (0 or 1) per channel.
+            '''
+            from .device_group import pack_actuation_program
+
+            if not self.set_actuation_program(pack_actuation_program(steps)):
+                raise ValueError('Error loading program.  Check number of '
+                                 'states matches channel count, program '
+                                 'fits in device buffer, and no program is '
+                                 'running.')
+
         @property
         def measured_voltage(self):
             # divide by 2 to convert from peak-to-peak to rms
@@ -223,6 +572,99 @@ try:
                 raise ValueError('Error setting state of channels.  Check '
                                  'number of states matches channel count.')
 
+        @property
+        def channel_duty(self):
+            '''
+            Duty cycle (0-1) of each channel while duty-cycle modulation is
+            running (see :meth:`start_duty_modulation`).
+
+            Duty cycles are rounded to the 16 ticks of a modulation period.
+            '''
+            return (np.asarray(super(ProxyMixin, self).channel_duty(),
+                               dtype=float) / 255)
+
+        @channel_duty.setter
+        def channel_duty(self, duty):
+            duty = np.clip(np.round(np.asarray(duty, dtype=float) * 255), 0,
+                           255).astype('uint8')
+            if not self.set_channel_duty(duty):
+                raise ValueError('Error setting channel duty.  Check number '
+                                 'of duty cycles matches channel count.')
+
+        @property
+        def duty_modulation_statistics(self):
+            '''
+            Returns
+            -------
+            pandas.Series
+                Target and achieved modulation rate (Hz), fraction of
+                modulation ticks skipped because the switching board writes of
+                the previous tick had not completed, mean number of port writes
+                per tick, and utilisation (0-1) of each I2C bus since
+                modulation was started.
+            '''
+            import pandas as pd
+
+            return pd.Series(np.asarray(self.duty_modulation_stats()),
+                             index=['target_hz', 'achieved_hz',
+                                    'skipped_fraction', 'writes_per_tick',
+                                    'i2c0_utilization', 'i2c1_utilization'])
+
+        @property
+        def i2c_master_statistics(self):
+            '''
+            Returns
+            -------
+            pandas.DataFrame
+                Transfer statistics of the non-blocking I2C masters used to
+                update the switching boards, with one column per I2C bus
+                (times are in microseconds).
+            '''
+            import pandas as pd
+
+            stats = np.asarray(self.i2c_master_stats()).reshape(2, -1).T
+            return pd.DataFrame(stats, columns=['i2c0', 'i2c1'],
+                                index=['completed', 'nack', 'arbitration_lost',
+                                       'timeout', 'bytes', 'busy_us',
+                                       'max_transfer_us', 'queue_high_water'])
+
+        @property
+        def dispatch_statistics(self):
+            '''
+            Returns
+            -------
+            pandas.DataFrame
+                Number of calls and mean/max CPU cycles to process each
+                command (from receipt of the complete request until the
+                response is sent), indexed by command code.
+            '''
+            import pandas as pd
+
+            stats = np.asarray(self.dispatch_stats(), dtype='uint32')
+            df_stats = pd.DataFrame(stats.reshape(-1, 4),
+                                    columns=['command_code', 'count',
+                                             'total_cycles', 'max_cycles'])
+            df_stats['mean_cycles'] = (df_stats.total_cycles /
+                                       df_stats['count'])
+            return (df_stats.set_index('command_code')
+                    [['count', 'mean_cycles', 'max_cycles']].sort_index())
+
+        def gpio_benchmark(self, iterations=1000):
+            '''
+            Returns
+            -------
+            pandas.DataFrame
+                Mean CPU cycles per call of the generic (``runtime``) and
+                compile-time pin (``fast``) versions of pin write, pin read,
+                and one-byte software SPI write (``shift_out``), measured on
+                the device.
+            '''
+            import pandas as pd
+
+            cycles = np.asarray(self.benchmark_gpio(iterations)).reshape(-1, 2)
+            return pd.DataFrame(cycles, columns=['runtime', 'fast'],
+                                index=['write', 'read', 'shift_out'])
+
         @property
         def baud_rate(self):
             return self.config['baud_rate']
@@ -295,48 +737,149 @@ try:
         def min_waveform_voltage(self):
             return float(super(ProxyMixin, self).min_waveform_voltage())
 
+        @property
+        def voltage_calibration(self):
+            '''
+            High-voltage calibration table stored in the device config (empty
+            if the ideal voltage divider model is used).
+
+            See also
+            --------
+            :mod:`dropbot_dx.calibration`
+            '''
+            from .calibration import unpack_voltage_calibration
+
+            return unpack_voltage_calibration(self.config
+                                              ['voltage_calibration'])
+
+        @voltage_calibration.setter
+        def voltage_calibration(self, df_calibration):
+            from .calibration import pack_voltage_calibration
+
+            if df_calibration is None:
+                data = ''
+            else:
+                data = pack_voltage_calibration(df_calibration)
+            return self.update_config(voltage_calibration=data)
+
+        @property
+        def adc_presets(self):
+            '''
+            Returns
+            -------
+            pandas.Series
+                Name of each saved ADC preset, indexed by preset slot.
+            '''
+            import pandas as pd
+
+            names = [super(ProxyMixin, self).adc_preset_name(i).tostring()
+                     for i in range(4)]
+            presets = pd.Series(names, name='name')
+            presets.index.name = 'index'
+            return presets[presets.str.len() > 0]
+
+        def save_adc_preset(self, index, name, adc_num=0):
+            '''
+            Save the current register configuration of an ADC (e.g., after
+            calling :meth:`setResolution`, :meth:`setAveraging`, etc.) to a
+            named preset slot in EEPROM.
+            '''
+            result = (super(ProxyMixin, self)
+                      .save_adc_preset(index, adc_num,
+                                       np.fromstring(name, dtype='uint8')))
+            if result == -2:
+                raise ValueError('ADC registers do not fit in preset slot.')
+            elif result != 0:
+                raise ValueError('Invalid preset index or name (at most 16 '
+                                 'characters).')
+
+        def apply_adc_preset(self, preset, adc_num=0):
+            '''
+            Apply a saved ADC preset in a single call.
+
+            Parameters
+            ----------
+            preset : int or str
+                Preset slot index or name.
+            adc_num : int, optional
+                ADC to configure.
+
+            Returns
+            -------
+            pandas.Series
+                ``switch_us``, the time taken to apply the preset (in
+                microseconds), and ``recalibrated``, whether the ADC was
+                recalibrated (only if the voltage reference changed).
+            '''
+            import pandas as pd
+
+            if isinstance(preset, basestring):
+                presets = self.adc_presets
+                matches = presets.index[presets == preset]
+                if not len(matches):
+                    raise KeyError('No ADC preset named `%s`.' % preset)
+                preset = matches[0]
+            result = super(ProxyMixin, self).apply_adc_preset(preset, adc_num)
+            if result == -2:
+                raise KeyError('ADC preset slot %d is empty.' % preset)
+            elif result < 0:
+                raise ValueError('Error applying ADC preset (%d).' % result)
+            return pd.Series([self.adc_preset_switch_us(),
+                              self.adc_preset_recalibrated()],
+                             index=['switch_us', 'recalibrated'])
 
         def initialize_switching_boards(self):
-            """
-            Embeded version of this function is not detecting switching boards properly. Use this for now...
-            """
-            PCA9505_CONFIG_IO_REGISTER = 0x18
-            PCA9505_OUTPUT_PORT_REGISTER = 0x08
+            '''
+            Probe all switching board addresses on the device and configure
+            each board found with all channels off.
 
-            # Check how many switching boards are connected.  Each additional board's
-            # address must equal the previous boards address +1 to be valid.
-            number_of_channels = 0
+            Returns
+            -------
+            dict
+                Switching board topology (see
+                :attr:`switching_board_topology`).
+            '''
+            return self._unpack_topology(self.scan_switching_boards())
 
-            try:
-                for chip in range(8):
-                    # set IO ports as inputs
-                    buffer = [PCA9505_CONFIG_IO_REGISTER, 0xFF]
-                    self.i2c_write(self.config['switching_board_i2c_address'] + chip, buffer)
-
-                    # read back the register value
-                    # if it matches what we previously set, this might be a PCA9505 chip
-                    if self.i2c_read(self.config['switching_board_i2c_address'] + chip, 1)[0] == 0xFF:
-                        # try setting all ports in output mode and initialize to ground
-                        port = 0
-                        for port in range(5):
-                            buffer = [PCA9505_CONFIG_IO_REGISTER + port, 0x00]
-                            self.i2c_write(self.config['switching_board_i2c_address'] + chip, buffer)
-
-                            # check that we successfully set the IO config register to 0x00
-                            if self.i2c_read(self.config['switching_board_i2c_address'] + chip, 1)[0] != 0x00:
-                                return
-
-                            buffer = [PCA9505_OUTPUT_PORT_REGISTER + port, 0xFF]
-                            self.i2c_write(self.config['switching_board_i2c_address'] + chip, buffer)
-
-                            # if port=4, it means that we successfully initialized all IO config
-                            # registers to 0x00, and this is probably a PCA9505 chip
-                            if port == 4:
-                                if number_of_channels == 40 * chip:
-                                    number_of_channels = 40 * (chip + 1)
-                    self.number_of_channels = number_of_channels
-            except:
-                pass
+        @property
+        def switching_board_topology(self):
+            '''
+            Returns
+            -------
+            dict
+                Switching board topology from the most recent scan, with the
+                keys:
+
+                 - ``number_of_channels``: number of usable channels.
+                 - ``chips``: :class:`pandas.DataFrame` with the I2C
+                   ``bus``, ``address`` and ``status`` of each chip.
+
+            See also
+            --------
+            :meth:`initialize_switching_boards`
+            '''
+            return self._unpack_topology(super(ProxyMixin, self)
+                                         .switching_board_topology())
+
+        def _unpack_topology(self, data):
+            import pandas as pd
+
+            data = np.asarray(data, dtype='uint8')
+            number_of_channels = int(data[2:4].view('<u2')[0])
+            status = pd.Categorical.from_codes(data[4:],
+                                               categories=['absent', 'ok',
+                                                           'mismatch',
+                                                           'bus_error'])
+            config = self.config
+            chip = np.arange(len(status))
+            bus = (config['switching_board_bus_map'] >> chip) & 0x01
+            address = config['switching_board_i2c_address'] + chip
+            df_chips = pd.DataFrame({'bus': bus, 'address': address,
+                                     'status': status},
+                                    columns=['bus', 'address', 'status'])
+            df_chips.index.name = 'chip'
+            return {'number_of_channels': number_of_channels,
+                    'chips': df_chips}
 
     class Proxy(ProxyMixin, _Proxy):
         pass
@@ -345,16 +888,116 @@ try:
         pass
 
     class SerialProxy(ProxyMixin, _SerialProxy):
-        def __init__(self, **kwargs):
+        '''
+        Parameters
+        ----------
+        device_uuid : str or uuid.UUID, optional
+            Only connect to the device with this UUID.  If the port cached
+            for this device is still present, it is connected to directly;
+            otherwise (or if that fails) the remaining ports are tried and
+            :class:`IOError` is raised if the first device that responds has
+            a different UUID.
+        port_cache : str, optional
+            Path of the cached map from serial port to device UUID (``None``
+            to disable).  Serial ports are still listed on every connect, but
+            a reconnect to a cached ``device_uuid`` only opens (and
+            handshakes with) its cached port.  Without ``device_uuid``,
+            cached ports are tried first.
+        **kwargs
+            Passed to the base class (e.g., ``port``).
+
+        Attributes
+        ----------
+        connect_timings : pandas.Series
+            Time spent listing serial ports (``scan_s``), connecting
+            (``connect_s``, including the handshake of every port tried), and
+            reading the device UUID (``uuid_s``), and the position of the
+            connected port in the order tried (``ports_tried``).
+        '''
+        def __init__(self, device_uuid=None, port_cache=PORT_CACHE_PATH,
+                     **kwargs):
+            import pandas as pd
+
+            if device_uuid is not None:
+                device_uuid = str(uuid.UUID(str(device_uuid)))
+            start = time.time()
+            ports = None
             if 'port' not in kwargs:
                 # No port was explicitly set.  Only try connecting to ports
                 # that correspond to a [Teensy 3.2 device][1].
                 #
                 # [1]: https://www.pjrc.com/store/teensy32.html
-                port = serial_ports().index.tolist()
-                if port:
-                    kwargs['port'] = port
-            super(SerialProxy, self).__init__(**kwargs)
+                ports = serial_ports().index.tolist()
+                cache = load_port_cache(port_cache) if port_cache else {}
+                cached = [port for port in ports if port in cache and
+                          (device_uuid is None or
+                           cache[port] == device_uuid)]
+                ports = cached + [port for port in ports
+                                  if port not in cached]
+                if ports:
+                    # The base class tries each port in order.
+                    kwargs['port'] = ports
+            scan_s = time.time() - start
+
+            start = time.time()
+            connected_uuid = None
+            ports_tried = 1
+            uuid_s = 0
+            if device_uuid is not None and ports and cached:
+                # Connect directly to the port cached for the requested
+                # device, without opening any other port.
+                port_kwargs = kwargs.copy()
+                port_kwargs['port'] = cached[0]
+                try:
+                    super(SerialProxy, self).__init__(**port_kwargs)
+                    uuid_start = time.time()
+                    connected_uuid = str(self.uuid)
+                    uuid_s = time.time() - uuid_start
+                except Exception:
+                    connected_uuid = None
+                if connected_uuid != device_uuid:
+                    # Device moved or was replaced; fall back to scanning
+                    # the remaining ports.
+                    if connected_uuid is not None and hasattr(self,
+                                                              'terminate'):
+                        self.terminate()
+                    connected_uuid = None
+                    ports = ports[1:]
+                    ports_tried += 1
+                    if ports:
+                        kwargs['port'] = ports
+                    else:
+                        kwargs.pop('port')
+            if connected_uuid is None:
+                super(SerialProxy, self).__init__(**kwargs)
+                uuid_start = time.time()
+                connected_uuid = str(self.uuid)
+                uuid_s = time.time() - uuid_start
+                ports_tried += (ports.index(self.port)
+                                if ports and self.port in ports else 0)
+            connect_s = time.time() - start - uuid_s
+            self.connect_timings = pd.Series([scan_s, connect_s, uuid_s,
+                                              ports_tried],
+                                             index=['scan_s', 'connect_s',
+                                                    'uuid_s', 'ports_tried'])
+            if port_cache:
+                cache = load_port_cache(port_cache)
+                if cache.get(self.port) != connected_uuid:
+                    # Each device is cached on a single port.
+                    cache = dict((port_i, uuid_i)
+                                 for port_i, uuid_i in cache.items()
+                                 if uuid_i != connected_uuid)
+                    cache[self.port] = connected_uuid
+                    try:
+                        save_port_cache(cache, port_cache)
+                    except (IOError, OSError):
+                        pass
+            if device_uuid is not None and connected_uuid != device_uuid:
+                port = self.port
+                if hasattr(self, 'terminate'):
+                    self.terminate()
+                raise IOError('Device on port %s is not %s.' % (port,
+                                                               device_uuid))
 
 except (ImportError, TypeError):
     Proxy = None
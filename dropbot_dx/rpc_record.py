@@ -0,0 +1,314 @@
+'''
+Record and replay the RPC traffic of a proxy.
+
+:class:`RpcRecorder` logs every request/response frame sent through a proxy
+(e.g., during a real session), and :func:`replay` re-issues a recording
+against a device (or :class:`RecordingSimulator`) at the original speed, a
+scaled speed, or as fast as possible, to regression-test firmware changes
+under realistic load.
+
+Example:
+
+    from dropbot_dx import SerialProxy
+    from dropbot_dx.rpc_record import RpcRecorder, load_recording, replay
+
+    proxy = SerialProxy()
+    with RpcRecorder(proxy) as recorder:
+        ...  # Use `proxy` as usual.
+    recorder.save('session.jsonl')
+
+    # Later (e.g., after a firmware update).
+    result = replay(proxy, load_recording('session.jsonl'), speed=2)
+    print(result['summary'])
+
+See also `python -m dropbot_dx.bin.rpc_replay --help`.
+'''
+from __future__ import division
+import binascii
+import json
+import threading
+import time
+import uuid
+
+import numpy as np
+import pandas as pd
+
+
+def _payload(packet):
+    '''
+    Returns
+    -------
+    bytes
+        Payload of a packet (or the bytes themselves).
+    '''
+    if packet is None:
+        return b''
+    data = getattr(packet, 'data', None)
+    return bytes(data() if callable(data) else packet)
+
+
+def _make_packet(payload):
+    '''
+    Returns
+    -------
+    nadamq.NadaMq.cPacket or bytes
+        Data packet with ``payload`` (``payload`` itself if ``nadamq`` is not
+        available, e.g., for a simulator).
+    '''
+    try:
+        from nadamq.NadaMq import cPacket, PACKET_TYPES
+    except ImportError:
+        return payload
+    return cPacket(type_=PACKET_TYPES.DATA, data=payload)
+
+
+def command_code(payload):
+    '''
+    Returns
+    -------
+    int
+        Command code of a request payload (first two bytes, little endian),
+        or -1 if the payload is too short.
+    '''
+    if len(payload) < 2:
+        return -1
+    return int(np.frombuffer(payload[:2], dtype='<u2')[0])
+
+
+class Recording(object):
+    '''
+    Recorded RPC session.
+
+    Attributes
+    ----------
+    metadata : dict
+        Session UUID, device UUID (if known), and start time.
+    frames : pandas.DataFrame
+        One row per request, with ``timestamp`` (seconds since start of the
+        recording), ``latency_s``, ``command_code``, ``request`` and
+        ``response`` (payload bytes), ``request_size`` and
+        ``response_size``.
+    '''
+    def __init__(self, metadata, frames):
+        self.metadata = metadata
+        self.frames = frames
+
+    def save(self, path):
+        '''
+        Save as JSON lines: metadata first, then one frame per line (with
+        payloads as hex strings).
+        '''
+        with open(path, 'w') as output:
+            output.write(json.dumps(self.metadata) + '\n')
+            for frame in self.frames.itertuples(index=False):
+                record = frame._asdict()
+                for key in ('request', 'response'):
+                    record[key] = binascii.hexlify(record[key]).decode('ascii')
+                output.write(json.dumps(dict((key, value.item()
+                                              if hasattr(value, 'item')
+                                              else value)
+                                             for key, value in
+                                             record.items())) + '\n')
+
+
+FRAME_COLUMNS = ['timestamp', 'latency_s', 'command_code', 'request',
+                 'response', 'request_size', 'response_size']
+
+
+def load_recording(path):
+    '''
+    Returns
+    -------
+    Recording
+        Recording saved by :meth:`Recording.save`.
+    '''
+    with open(path, 'r') as input_:
+        metadata = json.loads(input_.readline())
+        records = [json.loads(line) for line in input_ if line.strip()]
+    for record in records:
+        for key in ('request', 'response'):
+            record[key] = binascii.unhexlify(record[key])
+    return Recording(metadata, pd.DataFrame(records, columns=FRAME_COLUMNS))
+
+
+class RpcRecorder(object):
+    '''
+    Record all requests sent through ``proxy`` (by wrapping its
+    ``_send_command()`` method) while started.
+
+    Parameters
+    ----------
+    proxy : dropbot_dx.proxy.ProxyMixin
+    '''
+    def __init__(self, proxy):
+        self.proxy = proxy
+        self._lock = threading.Lock()
+        self._frames = []
+        self._metadata = {}
+        self._start = None
+
+    def __enter__(self):
+        self.start()
+        return self
+
+    def __exit__(self, *args):
+        self.stop()
+
+    def start(self):
+        '''
+        Clear any frames recorded so far, and start recording.
+        '''
+        if '_send_command' in self.proxy.__dict__:
+            raise RuntimeError('Proxy is already being recorded.')
+        try:
+            device_uuid = str(self.proxy.uuid)
+        except Exception:
+            device_uuid = None
+        self._frames = []
+        self._start = time.time()
+        self._metadata = {'session_uuid': str(uuid.uuid4()),
+                          'device_uuid': device_uuid,
+                          'start_time': self._start}
+        send_command = self.proxy._send_command
+
+        def _send_command(packet, *args, **kwargs):
+            start = time.time()
+            response = send_command(packet, *args, **kwargs)
+            end = time.time()
+            request = _payload(packet)
+            response_data = _payload(response)
+            with self._lock:
+                self._frames.append((start - self._start, end - start,
+                                     command_code(request), request,
+                                     response_data, len(request),
+                                     len(response_data)))
+            return response
+
+        self.proxy._send_command = _send_command
+
+    def stop(self):
+        '''
+        Stop recording (frames recorded so far are kept).
+        '''
+        self.proxy.__dict__.pop('_send_command', None)
+
+    @property
+    def recording(self):
+        '''
+        Returns
+        -------
+        Recording
+        '''
+        with self._lock:
+            frames = list(self._frames)
+        return Recording(dict(self._metadata),
+                         pd.DataFrame(frames, columns=FRAME_COLUMNS))
+
+    def save(self, path):
+        self.recording.save(path)
+
+
+class RecordingSimulator(object):
+    '''
+    Simulated device that answers each request with a response recorded
+    for the same request payload (or an empty response), after the recorded
+    latency (scaled by ``latency_scale``).
+
+    Responses recorded for the same request are returned in the recorded
+    order (repeating), so replaying a recording against its own simulator
+    reproduces every response.  Useful for testing replay itself, and for
+    measuring host overhead without a device.
+    '''
+    def __init__(self, recording, latency_scale=1.):
+        self.latency_scale = latency_scale
+        self._responses = {}
+        for frame in recording.frames.itertuples():
+            self._responses.setdefault(frame.request, []).append(
+                (frame.response, frame.latency_s))
+        self._counts = dict.fromkeys(self._responses, 0)
+        self._lock = threading.Lock()
+
+    def _send_command(self, packet, *args, **kwargs):
+        request = _payload(packet)
+        with self._lock:
+            if request not in self._responses:
+                return b''
+            responses = self._responses[request]
+            response, latency_s = responses[self._counts[request] %
+                                            len(responses)]
+            self._counts[request] += 1
+            time.sleep(latency_s * self.latency_scale)
+            return response
+
+
+def replay(target, recording, speed=1., ignore_commands=None):
+    '''
+    Re-issue the requests of a recording.
+
+    Parameters
+    ----------
+    target : dropbot_dx.proxy.ProxyMixin or RecordingSimulator
+    recording : Recording
+    speed : float, optional
+        Speed relative to the recording (e.g., 2 to send requests twice as
+        fast), or ``None`` to send each request as soon as the previous
+        response is received.
+    ignore_commands : list, optional
+        Command codes whose responses are expected to differ between runs
+        (e.g., time or analog reads), and are not compared.
+
+    Returns
+    -------
+    dict
+        ``frames``: per-request ``timestamp`` (relative to the start of the
+        replay), ``latency_s``, ``late_s`` (delay from scheduled send time)
+        and ``mismatch`` (response differs from recording);
+        ``summary``: :class:`pandas.Series` with request count, duration,
+        throughput (requests/s and bytes/s, both directions), latency
+        percentiles (ms), maximum schedule slip (ms) and number of response
+        mismatches.
+    '''
+    ignore_commands = set(ignore_commands or [])
+    frames = recording.frames
+    results = []
+    start = time.time()
+    for frame in frames.itertuples():
+        if speed is not None:
+            scheduled = start + frame.timestamp / speed
+            delay = scheduled - time.time()
+            if delay > 0:
+                time.sleep(delay)
+        else:
+            scheduled = time.time()
+        sent = time.time()
+        response = _payload(target._send_command(_make_packet(frame.request)))
+        received = time.time()
+        mismatch = (frame.command_code not in ignore_commands and
+                    response != frame.response)
+        results.append((sent - start, received - sent, sent - scheduled,
+                        len(response), mismatch))
+
+    df_frames = pd.DataFrame(results, columns=['timestamp', 'latency_s',
+                                               'late_s', 'response_size',
+                                               'mismatch'],
+                             index=frames.index)
+    df_frames.insert(0, 'command_code', frames.command_code)
+    duration_s = time.time() - start
+    latency_ms = df_frames.latency_s.values * 1e3
+    if not latency_ms.size:
+        latency_ms = np.zeros(1)
+    bytes_ = frames.request_size.sum() + df_frames.response_size.sum()
+    summary = pd.Series([len(df_frames), duration_s,
+                         len(df_frames) / duration_s if duration_s else 0,
+                         bytes_ / duration_s if duration_s else 0,
+                         np.percentile(latency_ms, 50),
+                         np.percentile(latency_ms, 90),
+                         np.percentile(latency_ms, 99), latency_ms.max(),
+                         df_frames.late_s.max() * 1e3 if len(df_frames)
+                         else 0, int(df_frames.mismatch.sum())],
+                        index=['requests', 'duration_s', 'requests_per_s',
+                               'bytes_per_s', 'latency_p50_ms',
+                               'latency_p90_ms', 'latency_p99_ms',
+                               'latency_max_ms', 'max_late_ms',
+                               'mismatches'])
+    return {'frames': df_frames, 'summary': summary}
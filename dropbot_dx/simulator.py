@@ -0,0 +1,186 @@
+'''
+Simulated DropBot DX, for testing host code (e.g.,
+:class:`dropbot_dx.device_group.DeviceGroup`) without hardware.
+
+:class:`SimulatedProxy` implements a subset of the device commands, with a
+fixed command latency (to simulate serial I/O) and an independent device
+clock.
+
+Example:
+
+    from dropbot_dx.device_group import DeviceGroup
+    from dropbot_dx.simulator import SimulatedProxy
+
+    group = DeviceGroup([SimulatedProxy() for i in range(4)])
+    group.upload_actuation_program([(100, [1] + 119 * [0])])
+    group.synchronized_start()
+'''
+from collections import OrderedDict
+import threading
+import time
+import uuid
+
+import numpy as np
+
+from .device_group import unpack_actuation_program
+
+
+class SimulatedProxy(object):
+    '''
+    Parameters
+    ----------
+    number_of_channels : int, optional
+        Number of channels (multiple of 8).
+    latency_s : float, optional
+        Duration of each command (the simulated device handles one command
+        at a time, like a serial device).
+    clock_offset_us : int, optional
+        Offset of the device clock (``microseconds()``) from the host clock
+        (default: random).
+    start_jitter_us : float, optional
+        Maximum error (uniform random) of the time an actuation program
+        starts, relative to the requested start time.
+    '''
+    def __init__(self, number_of_channels=120, latency_s=.002,
+                 clock_offset_us=None, start_jitter_us=0.):
+        if clock_offset_us is None:
+            clock_offset_us = np.random.randint(0, 2 ** 32, dtype='int64')
+        self.number_of_channels = number_of_channels
+        self.latency_s = latency_s
+        self.clock_offset_us = int(clock_offset_us)
+        self.start_jitter_us = start_jitter_us
+        self.uuid = uuid.uuid4()
+        self.state = OrderedDict([('voltage', 0.), ('frequency', 1e3),
+                                  ('hv_output_enabled', False),
+                                  ('hv_output_selected', False)])
+        self._lock = threading.Lock()
+        self._states = np.zeros(number_of_channels, dtype='uint8')
+        self._program = []
+        self._program_state = 0
+        self._program_step = 0
+        self._start_us = 0
+        self._actual_start_us = 0
+
+    def _command(self):
+        # Serialise commands, and simulate the serial round trip.
+        self._lock.acquire()
+        time.sleep(self.latency_s)
+        self._update_program()
+
+    def _device_us(self):
+        return (int(time.time() * 1e6) + self.clock_offset_us) & 0xFFFFFFFF
+
+    def _update_program(self):
+        if self._program_state not in (1, 2):
+            return
+        elapsed_us = (self._device_us() - self._actual_start_us) & 0xFFFFFFFF
+        if self._program_state == 1:
+            if elapsed_us >= 2 ** 31:
+                return  # Not started yet.
+            self._program_state = 2
+        # Apply the step active at the current time.
+        elapsed_us = (self._device_us() - self._start_us) & 0xFFFFFFFF
+        end_us = 0
+        for i, (duration_ms, states) in enumerate(self._program):
+            self._program_step = i
+            if states.size != self.number_of_channels:
+                self._program_state = 4
+                return
+            self._states = states
+            end_us += 1000 * duration_ms
+            if elapsed_us < end_us:
+                return
+        self._program_step = len(self._program)
+        self._program_state = 3
+
+    def microseconds(self):
+        self._command()
+        try:
+            return self._device_us()
+        finally:
+            self._lock.release()
+
+    def update_state(self, **kwargs):
+        self._command()
+        try:
+            for key in kwargs:
+                if key not in self.state:
+                    raise KeyError(key)
+            self.state.update(kwargs)
+        finally:
+            self._lock.release()
+
+    @property
+    def state_of_channels(self):
+        self._command()
+        try:
+            return self._states.copy()
+        finally:
+            self._lock.release()
+
+    @state_of_channels.setter
+    def state_of_channels(self, states):
+        self.set_state_of_channels(states)
+
+    def set_state_of_channels(self, states):
+        self._command()
+        try:
+            states = np.asarray(states, dtype='uint8')
+            if states.size != self.number_of_channels:
+                raise ValueError('Error setting state of channels.  Check '
+                                 'number of states matches channel count.')
+            self._states = states.copy()
+        finally:
+            self._lock.release()
+
+    def set_actuation_program(self, program):
+        self._command()
+        try:
+            program = np.asarray(program, dtype='uint8')
+            step_size = 4 + self.number_of_channels // 8
+            if (self._program_state in (1, 2) or not program.size or
+                    program.size % step_size):
+                return False
+            self._program = unpack_actuation_program(program,
+                                                     self.number_of_channels)
+            self._program_state = 0
+            return True
+        finally:
+            self._lock.release()
+
+    def start_actuation_program_at(self, start_us):
+        self._command()
+        try:
+            delay_us = (start_us - self._device_us()) & 0xFFFFFFFF
+            if (not self._program or self._program_state == 2 or
+                    delay_us == 0 or delay_us >= 2 ** 31):
+                return False
+            if any(states.size != self.number_of_channels
+                   for duration_ms, states in self._program):
+                self._program_state = 4
+                return False
+            jitter_us = int(np.random.uniform(0, self.start_jitter_us))
+            self._start_us = start_us
+            self._actual_start_us = (start_us + jitter_us) & 0xFFFFFFFF
+            self._program_step = 0
+            self._program_state = 1
+            return True
+        finally:
+            self._lock.release()
+
+    def stop_actuation_program(self):
+        self._command()
+        try:
+            if self._program_state in (1, 2):
+                self._program_state = 3
+        finally:
+            self._lock.release()
+
+    def actuation_program_status(self):
+        self._command()
+        try:
+            return np.array([self._program_state, self._program_step,
+                             len(self._program), self._start_us,
+                             self._actual_start_us], dtype='uint32')
+        finally:
+            self._lock.release()
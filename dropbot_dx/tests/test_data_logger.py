@@ -0,0 +1,46 @@
+import os
+import shutil
+import tempfile
+
+import h5py
+import numpy as np
+
+from dropbot_dx.data_logger import DataLogger
+
+
+def test_failed_dataset_does_not_lose_batch():
+    '''
+    Records of a dataset that cannot be written are counted as dropped,
+    without losing the records of other datasets in the same batch.
+    '''
+    directory = tempfile.mkdtemp()
+    try:
+        path = os.path.join(directory, 'log.h5')
+        # Dataset with fields that do not match the records logged below.
+        with h5py.File(path, 'w') as h5_file:
+            h5_file.create_dataset('b', shape=(0, ), maxshape=(None, ),
+                                   dtype=[('timestamp', 'float64'),
+                                          ('y', 'float64')])
+
+        logger = DataLogger(path, flush_interval_s=10.)
+        # Queue both datasets before the writer wakes up, so they are written
+        # in the same batch.
+        for i in range(10):
+            logger.log('a', timestamp=i, x=i)
+            logger.log('b', timestamp=i, x=i)
+        try:
+            logger.close()
+        except ValueError:
+            pass
+        else:
+            raise AssertionError('Expected error writing dataset `b`.')
+
+        statistics = logger.statistics
+        assert statistics.written == 10
+        assert statistics.dropped == 10
+        with h5py.File(path, 'r') as h5_file:
+            assert h5_file['a'].shape == (10, )
+            assert (h5_file['a']['x'] == np.arange(10)).all()
+            assert h5_file['b'].shape == (0, )
+    finally:
+        shutil.rmtree(directory)
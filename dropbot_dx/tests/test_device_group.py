@@ -0,0 +1,64 @@
+import time
+
+import numpy as np
+
+from dropbot_dx.device_group import DeviceGroup
+from dropbot_dx.simulator import SimulatedProxy
+
+
+def test_synchronized_start():
+    '''
+    Programs on simulated devices with different clocks start at the same
+    host time, within the reported uncertainty.
+    '''
+    start_jitter_us = 100
+    clock_offsets_us = [0, 12345678, 2 ** 31 + 17, 2 ** 32 - 1000]
+    proxies = [SimulatedProxy(clock_offset_us=offset_us,
+                              start_jitter_us=start_jitter_us)
+               for offset_us in clock_offsets_us]
+    with DeviceGroup(proxies) as group:
+        group.upload_actuation_program([(500, [1] + 119 * [0]),
+                                        (500, 120 * [0])])
+        df_start = group.synchronized_start(delay_s=.2)
+        time.sleep(.4)
+        df_status = group.actuation_program_status()
+
+    assert (df_status.state == 'running').all()
+    # Each program started within the simulated jitter of the requested
+    # device time...
+    assert (df_status.late_us >= 0).all()
+    assert (df_status.late_us <= start_jitter_us).all()
+    assert (df_status.late_us <= df_start.uncertainty_us).all()
+
+    # ...and the requested device times correspond to the same host time,
+    # within the uncertainty of each clock offset estimate.
+    def wrapped(us):
+        # Signed difference of 32-bit clock values.
+        return ((us + 2 ** 31) % 2 ** 32) - 2 ** 31
+
+    true_offset_us = np.array(clock_offsets_us, dtype='int64')
+    uncertainty_us = df_start.uncertainty_us.values
+    offset_error_us = wrapped(df_start.offset_us.values - true_offset_us)
+    assert (np.abs(offset_error_us) <= uncertainty_us).all()
+    host_start_us = df_start.start_us.values - true_offset_us
+    skew_us = wrapped(host_start_us - host_start_us[0])
+    assert (np.abs(skew_us) <= uncertainty_us + uncertainty_us[0]).all()
+
+
+def test_channel_count_change_stops_program():
+    '''
+    A program whose steps no longer match the channel count is not started,
+    and is reported in the error state.
+    '''
+    proxy = SimulatedProxy(number_of_channels=120)
+    with DeviceGroup([proxy]) as group:
+        group.upload_actuation_program([(100, 120 * [0])])
+        proxy.number_of_channels = 80
+        try:
+            group.synchronized_start(delay_s=.2)
+        except IOError:
+            pass
+        else:
+            raise AssertionError('Expected start to fail.')
+        df_status = group.actuation_program_status()
+    assert (df_status.state == 'error').all()
@@ -0,0 +1,58 @@
+import os
+import shutil
+import struct
+import tempfile
+import uuid
+
+from dropbot_dx.rpc_record import (RecordingSimulator, RpcRecorder,
+                                   load_recording, replay)
+
+
+class CountingDevice(object):
+    '''
+    Fake device whose response to each request includes the number of
+    requests received so far (so repeated requests get different
+    responses).
+    '''
+    def __init__(self):
+        self.uuid = uuid.uuid4()
+        self.count = 0
+
+    def _send_command(self, packet):
+        self.count += 1
+        return bytes(packet[:2]) + struct.pack('<I', self.count)
+
+
+def test_record_save_load_replay():
+    device = CountingDevice()
+    requests = [struct.pack('<HB', code, i % 3)
+                for i, code in enumerate([10, 11, 10, 12, 10, 11, 13] * 5)]
+    with RpcRecorder(device) as recorder:
+        for request in requests:
+            device._send_command(request)
+    recording = recorder.recording
+    assert len(recording.frames) == len(requests)
+    assert device._send_command.__self__ is device  # Recorder removed.
+
+    directory = tempfile.mkdtemp()
+    try:
+        path = os.path.join(directory, 'session.jsonl')
+        recording.save(path)
+        loaded = load_recording(path)
+    finally:
+        shutil.rmtree(directory)
+
+    assert loaded.metadata == recording.metadata
+    assert (loaded.frames.command_code == recording.frames.command_code).all()
+    assert list(loaded.frames.request) == requests
+    assert list(loaded.frames.response) == list(recording.frames.response)
+
+    result = replay(RecordingSimulator(loaded, latency_scale=0), loaded,
+                    speed=None)
+    assert result['summary']['requests'] == len(requests)
+    assert result['summary']['mismatches'] == 0
+
+    # Responses that differ from the recording are reported.
+    device.count = 1000
+    result = replay(device, loaded, speed=None)
+    assert result['summary']['mismatches'] == len(requests)
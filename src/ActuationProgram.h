@@ -0,0 +1,163 @@
+#ifndef ___ACTUATION_PROGRAM__H___
+#define ___ACTUATION_PROGRAM__H___
+
+#include <stdint.h>
+#include <string.h>
+#include <Arduino.h>
+#include <CArrayDefs.h>
+
+
+#ifndef ACTUATION_PROGRAM_SIZE
+#define ACTUATION_PROGRAM_SIZE   1024  // Bytes of program steps.
+#endif  // #ifndef ACTUATION_PROGRAM_SIZE
+
+#ifndef ACTUATION_PROGRAM_SPIN_US
+#define ACTUATION_PROGRAM_SPIN_US   2000
+#endif  // #ifndef ACTUATION_PROGRAM_SPIN_US
+
+
+namespace dropbot_dx {
+
+template <size_t Size>
+class ActuationProgram {
+  /* # Timed sequence of channel states #
+   *
+   * A program is a list of steps, each a `uint32_t` duration (ms, little
+   * endian) followed by the packed channel states (as passed to
+   * `set_state_of_channels()`).
+   *
+   * A program is started at a given `micros()` time (`arm()`), so that
+   * several devices may be started together once their clock offsets are
+   * known.  `poll()` (from `loop()`) busy-waits for the start time once it
+   * is within `ACTUATION_PROGRAM_SPIN_US`, so the start is not delayed by
+   * the polling interval (unless `loop()` itself is blocked for longer).
+   *
+   * Step times are relative to the requested start time (not the time each
+   * step was applied), so steps do not drift.
+   *
+   * A program stops in the `ERROR` state if its steps do not match the
+   * channel states size when armed, or if a step could not be applied (see
+   * `fail()`). */
+public:
+  enum state_t {
+    IDLE = 0,
+    ARMED = 1,
+    RUNNING = 2,
+    COMPLETE = 3,
+    ERROR = 4,
+  };
+
+  ActuationProgram()
+    : length_(0), step_size_(0), step_count_(0), state_(IDLE), step_(0),
+      start_us_(0), actual_start_us_(0), step_end_us_(0) {}
+
+  bool load(uint8_t const *data, uint16_t length, uint8_t states_size) {
+    const uint8_t step_size = sizeof(uint32_t) + states_size;
+    if (state_ == ARMED || state_ == RUNNING || states_size == 0 ||
+        length == 0 || length > Size || length % step_size) {
+      return false;
+    }
+    memcpy(data_, data, length);
+    step_size_ = step_size;
+    length_ = length;
+    step_count_ = length / step_size_;
+    state_ = IDLE;
+    return true;
+  }
+
+  bool arm(uint32_t start_us, uint8_t states_size) {
+    /* Returns `false` if no program is loaded, or `start_us` has passed.
+     *
+     * Also returns `false` (and stops with `ERROR`) if the channel states of
+     * each step are not `states_size` bytes, e.g., if the number of channels
+     * has changed since the program was loaded. */
+    if (step_count_ == 0 || state_ == RUNNING ||
+        (int32_t)(start_us - micros()) <= 0) {
+      return false;
+    }
+    if (states_size != step_size_ - sizeof(uint32_t)) {
+      state_ = ERROR;
+      return false;
+    }
+    start_us_ = start_us;
+    step_ = 0;
+    state_ = ARMED;
+    return true;
+  }
+
+  void stop() {
+    if (state_ == ARMED || state_ == RUNNING) { state_ = COMPLETE; }
+  }
+  void fail() {
+    /* Stop with `ERROR` (e.g., if the states of a step could not be
+     * applied). */
+    if (state_ == ARMED || state_ == RUNNING) { state_ = ERROR; }
+  }
+
+  int16_t poll() {
+    /* Returns index of step to apply now, or -1. */
+    if (state_ == ARMED) {
+      if ((int32_t)(start_us_ - micros()) > ACTUATION_PROGRAM_SPIN_US) {
+        return -1;
+      }
+      while ((int32_t)(start_us_ - micros()) > 0) {}
+      actual_start_us_ = micros();
+      state_ = RUNNING;
+      step_ = 0;
+      step_end_us_ = start_us_ + 1000UL * _duration_ms(0);
+      return 0;
+    } else if (state_ == RUNNING &&
+               (int32_t)(micros() - step_end_us_) >= 0) {
+      if (++step_ >= step_count_) {
+        state_ = COMPLETE;
+        return -1;
+      }
+      step_end_us_ += 1000UL * _duration_ms(step_);
+      return step_;
+    }
+    return -1;
+  }
+
+  UInt8Array step_states(uint16_t step) {
+    return UInt8Array_init(step_size_ - sizeof(uint32_t),
+                           &data_[step * step_size_ + sizeof(uint32_t)]);
+  }
+
+  UInt32Array status(UInt8Array buffer) const {
+    /* Returns state, current step, number of steps, requested start time,
+     * and time the first step was applied (`micros()`). */
+    UInt32Array output;
+    output.length = 5;
+    output.data = reinterpret_cast<uint32_t *>(&buffer.data[0]);
+    output.data[0] = state_;
+    output.data[1] = step_;
+    output.data[2] = step_count_;
+    output.data[3] = start_us_;
+    output.data[4] = actual_start_us_;
+    return output;
+  }
+
+  state_t state() const { return state_; }
+
+private:
+  uint32_t _duration_ms(uint16_t step) const {
+    uint32_t duration_ms;
+    memcpy(&duration_ms, &data_[step * step_size_], sizeof(duration_ms));
+    return duration_ms;
+  }
+
+  uint8_t data_[Size];
+  uint16_t length_;
+  uint8_t step_size_;
+  uint16_t step_count_;
+  state_t state_;
+  uint16_t step_;
+  uint32_t start_us_;
+  uint32_t actual_start_us_;
+  uint32_t step_end_us_;
+};
+
+}  // namespace dropbot_dx
+
+
+#endif  // #ifndef ___ACTUATION_PROGRAM__H___
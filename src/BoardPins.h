@@ -0,0 +1,105 @@
+#ifndef ___BOARD_PINS__H___
+#define ___BOARD_PINS__H___
+
+#include <stdint.h>
+#include <Arduino.h>
+
+
+#ifndef HARDWARE_REVISION
+#define HARDWARE_REVISION   3  // Hardware version 0.3 (see `HARDWARE_VERSION_`).
+#endif  // #ifndef HARDWARE_REVISION
+
+// Minimum time the clock of `shift_out_msb_first()` is held high and low
+// (the MCP41050 requires at least 40 ns each).
+#ifndef SHIFT_OUT_HALF_PERIOD_NS
+#define SHIFT_OUT_HALF_PERIOD_NS   50
+#endif  // #ifndef SHIFT_OUT_HALF_PERIOD_NS
+
+
+namespace dropbot_dx {
+
+template <uint8_t Pin>
+struct FastPin {
+  /* Digital pin resolved at compile time.
+   *
+   * `digitalWriteFast()`/`digitalReadFast()` with a constant pin compile to a
+   * single access of the port set/clear/input register, whereas
+   * `digitalWrite()`/`digitalRead()` look the pin up in a table on every
+   * call. */
+  static const uint8_t PIN = Pin;
+
+  static void output() { pinMode(Pin, OUTPUT); }
+  static void high() { digitalWriteFast(Pin, HIGH); }
+  static void low() { digitalWriteFast(Pin, LOW); }
+  static void write(bool value) {
+    if (value) { high(); } else { low(); }
+  }
+  static bool read() { return digitalReadFast(Pin); }
+};
+
+
+template <uint32_t Nanoseconds>
+inline void delay_ns() {
+  /* Busy-wait for at least `Nanoseconds`.
+   *
+   * Each iteration of the loop takes at least one CPU cycle (a `nop` may be
+   * dropped from the pipeline, so it cannot be used to count cycles). */
+  static const uint32_t CYCLES = ((uint64_t)Nanoseconds * F_CPU +
+                                  999999999UL) / 1000000000UL;
+  if (CYCLES == 0) { return; }
+  uint32_t count = CYCLES;
+  __asm__ volatile("1: subs %0, %0, #1\n\tbne 1b" : "+r" (count) :: "cc");
+}
+
+
+template <typename DataPin, typename ClockPin>
+inline void shift_out_msb_first(uint8_t value) {
+  /* Equivalent of `shiftOut(data, clock, MSBFIRST, value)`.
+   *
+   * Back-to-back pin writes take only a few CPU cycles, so the clock is held
+   * high and low (and data is set up) for at least
+   * `SHIFT_OUT_HALF_PERIOD_NS`. */
+  for (uint8_t mask = 0x80; mask; mask >>= 1) {
+    DataPin::write(value & mask);
+    delay_ns<SHIFT_OUT_HALF_PERIOD_NS>();
+    ClockPin::high();
+    delay_ns<SHIFT_OUT_HALF_PERIOD_NS>();
+    ClockPin::low();
+  }
+}
+
+
+template <uint8_t Revision> struct BoardPins;
+
+template <>
+struct BoardPins<3> {
+  // Waveform output (toggled in `Node::timer_callback()`).
+  static const uint8_t HIGH_PIN = 6;
+  static const uint8_t LOW_PIN = 7;
+  static const uint8_t LIGHT_PIN = 5;
+
+  // pins connected to the boost converter
+  static const uint8_t MCP41050_CS_PIN = 10;
+  static const uint8_t SHDN_PIN = 4;
+
+  static const uint8_t HV_OUTPUT_SELECT_PIN = 8;
+
+  // SPI pins
+  static const uint8_t SCK_PIN = 13;
+  static const uint8_t MOSI_PIN = 11;
+
+  typedef FastPin<HIGH_PIN> high_pin_t;
+  typedef FastPin<LOW_PIN> low_pin_t;
+  typedef FastPin<MCP41050_CS_PIN> mcp41050_cs_pin_t;
+  typedef FastPin<SHDN_PIN> shdn_pin_t;
+  typedef FastPin<HV_OUTPUT_SELECT_PIN> hv_output_select_pin_t;
+  typedef FastPin<SCK_PIN> sck_pin_t;
+  typedef FastPin<MOSI_PIN> mosi_pin_t;
+};
+
+typedef BoardPins<HARDWARE_REVISION> board_pins_t;
+
+}  // namespace dropbot_dx
+
+
+#endif  // #ifndef ___BOARD_PINS__H___
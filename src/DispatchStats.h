@@ -0,0 +1,112 @@
+#ifndef ___DISPATCH_STATS__H___
+#define ___DISPATCH_STATS__H___
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <Arduino.h>
+#include <CArrayDefs.h>
+
+
+#ifndef DISPATCH_STATS_SLOTS
+#define DISPATCH_STATS_SLOTS   32  // Must be a power of two.
+#endif  // #ifndef DISPATCH_STATS_SLOTS
+
+
+namespace dropbot_dx {
+
+template <size_t Slots>
+class DispatchStats {
+  /* # Per-command RPC dispatch timing #
+   *
+   * Call `on_dispatch()` before (`complete == false`) and after each command
+   * is processed (e.g., from the `SerialPacketQueue` dispatch hook).  The
+   * cycles between the two calls are accumulated per command code.
+   *
+   * Command codes map to slots by open addressing, so lookup is
+   * constant-time (for a table that is not full).  Commands that arrive once
+   * all slots are used are not counted.
+   *
+   * This only measures dispatch: the command processor (and the command
+   * codes) are generated by `base-node-rpc`, outside this repository.  Use
+   * these counts to compare builds before and after a change to the
+   * generated dispatcher. */
+public:
+  static const uint16_t EMPTY = 0xFFFF;
+  static const uint8_t FIELDS = 4;  // Fields per slot in `read()` output.
+
+  DispatchStats() : start_cycles_(0), active_slot_(-1) { reset(); }
+
+  void reset() {
+    for (size_t i = 0; i < Slots; i++) {
+      slots_[i].command_code = EMPTY;
+      slots_[i].count = 0;
+      slots_[i].total_cycles = 0;
+      slots_[i].max_cycles = 0;
+    }
+    active_slot_ = -1;
+  }
+
+  void on_dispatch(uint16_t command_code, bool complete) {
+    if (!complete) {
+      active_slot_ = _find_slot(command_code);
+      start_cycles_ = ARM_DWT_CYCCNT;
+    } else if (active_slot_ >= 0) {
+      const uint32_t cycles = ARM_DWT_CYCCNT - start_cycles_;
+      Slot &slot = slots_[active_slot_];
+      slot.count++;
+      slot.total_cycles += cycles;
+      if (cycles > slot.max_cycles) { slot.max_cycles = cycles; }
+      active_slot_ = -1;
+    }
+  }
+
+  UInt32Array read(UInt8Array buffer) const {
+    /* Returns `(command code, count, total cycles, max cycles)` for each
+     * command seen since reset. */
+    UInt32Array output;
+    output.data = reinterpret_cast<uint32_t *>(&buffer.data[0]);
+    output.length = 0;
+    const uint32_t max_length = buffer.length / sizeof(uint32_t);
+    for (size_t i = 0; i < Slots; i++) {
+      Slot const &slot = slots_[i];
+      if (slot.command_code == EMPTY || slot.count == 0) { continue; }
+      if (output.length + FIELDS > max_length) { break; }
+      output.data[output.length++] = slot.command_code;
+      output.data[output.length++] = slot.count;
+      output.data[output.length++] = slot.total_cycles;
+      output.data[output.length++] = slot.max_cycles;
+    }
+    return output;
+  }
+
+private:
+  struct Slot {
+    uint16_t command_code;
+    uint32_t count;
+    uint32_t total_cycles;
+    uint32_t max_cycles;
+  };
+
+  int16_t _find_slot(uint16_t command_code) {
+    const size_t start = command_code & (Slots - 1);
+    for (size_t i = 0; i < Slots; i++) {
+      const size_t index = (start + i) & (Slots - 1);
+      if (slots_[index].command_code == command_code) { return index; }
+      if (slots_[index].command_code == EMPTY) {
+        slots_[index].command_code = command_code;
+        return index;
+      }
+    }
+    return -1;
+  }
+
+  Slot slots_[Slots];
+  uint32_t start_cycles_;
+  int16_t active_slot_;
+};
+
+}  // namespace dropbot_dx
+
+
+#endif  // #ifndef ___DISPATCH_STATS__H___
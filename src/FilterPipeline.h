@@ -0,0 +1,225 @@
+#ifndef ___FILTER_PIPELINE__H___
+#define ___FILTER_PIPELINE__H___
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <Arduino.h>
+#include <CArrayDefs.h>
+
+
+#ifndef FILTER_MAX_TAPS
+#define FILTER_MAX_TAPS   64  // Must be even.
+#endif  // #ifndef FILTER_MAX_TAPS
+
+#ifndef FILTER_OUTPUT_SIZE
+#define FILTER_OUTPUT_SIZE   1024  // Must be a power of two.
+#endif  // #ifndef FILTER_OUTPUT_SIZE
+
+
+namespace dropbot_dx {
+
+inline int32_t smlad(uint32_t x, uint32_t y, int32_t accumulator) {
+  /* Dual 16-bit multiply, with both products added to `accumulator`
+   * (i.e., `accumulator + x[0] * y[0] + x[1] * y[1]`, modulo `2^32`). */
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+  int32_t result;
+  __asm__("smlad %0, %1, %2, %3" : "=r" (result)
+          : "r" (x), "r" (y), "r" (accumulator));
+  return result;
+#else
+  return (int32_t)((uint32_t)accumulator +
+                   (uint32_t)((int32_t)(int16_t)x * (int16_t)y) +
+                   (uint32_t)((int32_t)(int16_t)(x >> 16) *
+                              (int16_t)(y >> 16)));
+#endif
+}
+
+
+inline int16_t saturate_16(int32_t value) {
+  return (value > INT16_MAX) ? INT16_MAX
+    : ((value < INT16_MIN) ? INT16_MIN : value);
+}
+
+
+template <size_t MaxTaps, size_t OutputSize>
+class FilterPipeline {
+  /* # Decimating CIC + Q15 FIR filter #
+   *
+   * Each input sample `x` (raw ADC value, minus `offset`) passes through:
+   *
+   *  1. A CIC decimator with `stages` integrator/comb stages, decimation
+   *     ratio `2^cic_shift` and unit differential delay.  The output is
+   *     divided by the CIC gain (`2^(stages * cic_shift)`, with an arithmetic
+   *     shift) and saturated to 16 bits.  All CIC arithmetic is modulo
+   *     `2^32`, so `stages * cic_shift` must be at most 15.
+   *  2. An FIR filter with Q15 coefficients `h`, which computes
+   *     `y[n] = sum(h[k] * x[n - k])` for every `fir_decimation`-th CIC
+   *     output.  Products are accumulated in 32 bits (modulo `2^32`), then
+   *     rounded to Q15 and saturated to 16 bits.
+   *
+   * Filtered samples are queued in a ring of `OutputSize` samples; samples
+   * that do not fit are dropped (and counted).
+   *
+   * The same arithmetic is implemented by `dropbot_dx.filters` on the host,
+   * so the output must match exactly. */
+public:
+  FilterPipeline()
+    : taps_(0), stages_(1), cic_shift_(0), fir_decimation_(1), offset_(0),
+      output_head_(0), output_tail_(0) {
+    // Pass-through (single tap of 1 - 2^-15) until coefficients are set.
+    const int16_t identity = INT16_MAX;
+    set_coefficients(&identity, 1);
+  }
+
+  bool configure(uint8_t stages, uint8_t cic_shift, uint8_t fir_decimation,
+                 uint16_t offset) {
+    if (stages < 1 || stages > MAX_STAGES || stages * cic_shift > 15 ||
+        fir_decimation == 0) {
+      return false;
+    }
+    stages_ = stages;
+    cic_shift_ = cic_shift;
+    fir_decimation_ = fir_decimation;
+    offset_ = offset;
+    reset();
+    return true;
+  }
+
+  bool set_coefficients(int16_t const *coefficients, size_t count) {
+    /* Coefficients are stored in reverse order (oldest sample first), padded
+     * with a leading zero to an even number of taps. */
+    if (count == 0 || count > MaxTaps) { return false; }
+    const size_t taps = count + (count & 1);
+    memset(coefficients_, 0, sizeof(coefficients_));
+    for (size_t i = 0; i < count; i++) {
+      coefficients_[taps - 1 - i] = coefficients[i];
+    }
+    taps_ = taps;
+    reset();
+    return true;
+  }
+
+  void reset() {
+    memset(integrators_, 0, sizeof(integrators_));
+    memset(combs_, 0, sizeof(combs_));
+    memset(delay_, 0, sizeof(delay_));
+    cic_phase_ = 0;
+    fir_phase_ = 0;
+    delay_index_ = 0;
+    input_count_ = 0;
+    output_count_ = 0;
+    dropped_count_ = 0;
+    cycles_ = 0;
+    output_head_ = output_tail_;
+  }
+
+  void process(volatile int16_t const *samples, size_t count) {
+    const uint32_t start = ARM_DWT_CYCCNT;
+    const uint16_t decimation = 1 << cic_shift_;
+    const uint8_t shift = stages_ * cic_shift_;
+
+    for (size_t i = 0; i < count; i++) {
+      // Unsigned, so integrator overflow wraps (as intended).
+      uint32_t value = (uint32_t)(uint16_t)samples[i] - offset_;
+      for (uint8_t s = 0; s < stages_; s++) {
+        integrators_[s] += value;
+        value = integrators_[s];
+      }
+      if (++cic_phase_ < decimation) { continue; }
+      cic_phase_ = 0;
+      for (uint8_t s = 0; s < stages_; s++) {
+        const uint32_t previous = combs_[s];
+        combs_[s] = value;
+        value -= previous;
+      }
+      _push_fir(saturate_16((int32_t)value >> shift));
+    }
+    input_count_ += count;
+    cycles_ += ARM_DWT_CYCCNT - start;
+  }
+
+  UInt16Array read(UInt8Array buffer) {
+    /* Pop up to a buffer of filtered samples (as `uint16_t`, i.e., the bits
+     * of each `int16_t` sample). */
+    UInt16Array output;
+    output.data = reinterpret_cast<uint16_t *>(&buffer.data[0]);
+    output.length = 0;
+    const uint32_t max_length = buffer.length / sizeof(uint16_t);
+    while (output.length < max_length && output_tail_ != output_head_) {
+      output.data[output.length++] =
+        (uint16_t)output_[output_tail_ & (OutputSize - 1)];
+      output_tail_++;
+    }
+    return output;
+  }
+
+  uint32_t input_count() const { return input_count_; }
+  uint32_t output_count() const { return output_count_; }
+  uint32_t dropped_count() const { return dropped_count_; }
+  uint32_t available() const { return output_head_ - output_tail_; }
+  uint64_t cycles() const { return cycles_; }
+  uint8_t taps() const { return taps_; }
+
+  static const uint8_t MAX_STAGES = 4;
+
+private:
+  void _push_fir(int16_t value) {
+    // Each sample is written twice, so the `taps_` most recent samples are
+    // always contiguous, starting (oldest first) at `delay_index_`.
+    delay_[delay_index_] = value;
+    delay_[delay_index_ + taps_] = value;
+    if (++delay_index_ >= taps_) { delay_index_ = 0; }
+    if (++fir_phase_ < fir_decimation_) { return; }
+    fir_phase_ = 0;
+
+    int16_t const *window = &delay_[delay_index_];
+    int32_t accumulator = 0;
+    for (uint8_t i = 0; i < taps_; i += 2) {
+      // Two taps per multiply-accumulate instruction.  Word loads of the
+      // delay line may be unaligned (supported by the Cortex-M4).
+      uint32_t x, h;
+      memcpy(&x, &window[i], sizeof(x));
+      memcpy(&h, &coefficients_[i], sizeof(h));
+      accumulator = smlad(x, h, accumulator);
+    }
+    // Round Q30 to Q15.
+    _push_output(saturate_16((int32_t)((uint32_t)accumulator + (1 << 14))
+                             >> 15));
+  }
+
+  void _push_output(int16_t value) {
+    output_count_++;
+    if (output_head_ - output_tail_ >= OutputSize) {
+      dropped_count_++;
+      return;
+    }
+    output_[output_head_ & (OutputSize - 1)] = value;
+    output_head_++;
+  }
+
+  int16_t coefficients_[MaxTaps];
+  int16_t delay_[2 * MaxTaps];
+  uint32_t integrators_[MAX_STAGES];
+  uint32_t combs_[MAX_STAGES];
+  uint8_t taps_;
+  uint8_t stages_;
+  uint8_t cic_shift_;
+  uint8_t fir_decimation_;
+  uint16_t offset_;
+  uint16_t cic_phase_;
+  uint8_t fir_phase_;
+  uint8_t delay_index_;
+  uint32_t input_count_;
+  uint32_t output_count_;
+  uint32_t dropped_count_;
+  uint64_t cycles_;
+  int16_t output_[OutputSize];
+  uint32_t output_head_;
+  uint32_t output_tail_;
+};
+
+}  // namespace dropbot_dx
+
+
+#endif  // #ifndef ___FILTER_PIPELINE__H___
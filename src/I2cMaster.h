@@ -0,0 +1,387 @@
+#ifndef ___I2C_MASTER__H___
+#define ___I2C_MASTER__H___
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <Arduino.h>
+#include <Wire.h>
+
+
+#ifndef I2C_QUEUE_DEPTH
+#define I2C_QUEUE_DEPTH   32  // Must be a power of two.
+#endif  // #ifndef I2C_QUEUE_DEPTH
+
+#ifndef I2C_TRANSFER_MAX_TX
+#define I2C_TRANSFER_MAX_TX   8
+#endif  // #ifndef I2C_TRANSFER_MAX_TX
+
+
+namespace dropbot_dx {
+
+struct I2cRegisters {
+  /* Register layout of a Kinetis I2C module (see chapter 44 of the
+   * [K20 reference manual][1]).
+   *
+   * [1]: https://www.pjrc.com/teensy/K20P64M72SF1RM.pdf */
+  volatile uint8_t A1;
+  volatile uint8_t F;
+  volatile uint8_t C1;
+  volatile uint8_t S;
+  volatile uint8_t D;
+  volatile uint8_t C2;
+  volatile uint8_t FLT;
+  volatile uint8_t RA;
+  volatile uint8_t SMB;
+  volatile uint8_t A2;
+  volatile uint8_t SLTH;
+  volatile uint8_t SLTL;
+};
+
+
+struct I2cTransfer;
+typedef void (*i2c_callback_t)(void *context, I2cTransfer const &transfer);
+
+struct I2cTransfer {
+  /* Write `tx_length` bytes from `tx` and then (after a repeated start) read
+   * `rx_length` bytes into `rx`.
+   *
+   * A transfer with no bytes to write or read only addresses the device
+   * (e.g., to trigger a sensor measurement). */
+  enum status_t {
+    QUEUED = 0,
+    ACTIVE = 1,
+    OK = 2,
+    NACK = -1,
+    ARBITRATION_LOST = -2,
+    TIMEOUT = -3,
+    CANCELLED = -4  // Removed from the queue before it started (`cancel()`).
+  };
+
+  uint8_t address;
+  uint8_t tx_length;
+  uint8_t tx[I2C_TRANSFER_MAX_TX];
+  uint8_t rx_length;
+  uint8_t *rx;  // Must stay valid until the transfer completes.
+  uint16_t tag;  // Caller-defined.
+  i2c_callback_t callback;
+  void *context;
+  volatile int8_t status;
+  uint32_t start_us;
+  uint32_t end_us;
+
+  uint32_t duration_us() const { return end_us - start_us; }
+};
+
+
+struct I2cMasterStats {
+  uint32_t completed;
+  uint32_t nack;
+  uint32_t arbitration_lost;
+  uint32_t timeout;
+  uint32_t bytes;
+  uint32_t busy_us;
+  uint32_t max_transfer_us;
+  uint32_t queue_high_water;
+};
+
+
+class I2cMaster {
+  /* # Non-blocking I2C master #
+   *
+   * Transfers are queued with `enqueue()` and moved byte-by-byte by the I2C
+   * interrupt, so the main loop keeps running while a transfer is on the
+   * bus.  Completed transfers are handed to their callbacks from `poll()`
+   * (i.e., from the main loop, *not* from the interrupt).
+   *
+   * `enqueue()` may be called from an interrupt.
+   *
+   * While busy, the I2C interrupt vector is pointed at this engine; the
+   * previous handler (e.g., the `Wire` slave handler) is restored once the
+   * queue is empty. */
+public:
+  static const uint16_t QUEUE_MASK = I2C_QUEUE_DEPTH - 1;
+
+  I2cMaster(I2cRegisters &registers, uint8_t irq)
+    : registers_(registers), irq_(irq), isr_(NULL), previous_isr_(NULL),
+      dispatch_(0), active_(0), tail_(0), busy_(false), index_(0),
+      phase_(IDLE), timeout_us_(2000) {
+    memset(&stats_, 0, sizeof(stats_));
+  }
+
+  void begin(void (*isr)(void)) {
+    /* `isr` must call `on_interrupt()` for this engine. */
+    isr_ = isr;
+    NVIC_SET_PRIORITY(irq_, 64);
+  }
+
+  I2cTransfer *enqueue(uint8_t address, uint8_t const *tx, uint8_t tx_length,
+                       uint8_t *rx=NULL, uint8_t rx_length=0, uint16_t tag=0,
+                       i2c_callback_t callback=NULL, void *context=NULL) {
+    /* Queue a transfer.  Returns `NULL` if the queue is full. */
+    if (tx_length > I2C_TRANSFER_MAX_TX) { return NULL; }
+
+    // Save and restore interrupt mask, since this may be called from an
+    // interrupt (or with interrupts already disabled).
+    const uint32_t primask = _disable_irq();
+    if (((tail_ + 1) & QUEUE_MASK) == dispatch_) {
+      _restore_irq(primask);
+      return NULL;
+    }
+    I2cTransfer &transfer = queue_[tail_];
+    transfer.address = address;
+    transfer.tx_length = tx_length;
+    if (tx_length) { memcpy(transfer.tx, tx, tx_length); }
+    transfer.rx = rx;
+    transfer.rx_length = rx_length;
+    transfer.tag = tag;
+    transfer.callback = callback;
+    transfer.context = context;
+    transfer.status = I2cTransfer::QUEUED;
+    tail_ = (tail_ + 1) & QUEUE_MASK;
+
+    const uint16_t depth = (tail_ - dispatch_) & QUEUE_MASK;
+    if (depth > stats_.queue_high_water) { stats_.queue_high_water = depth; }
+    if (!busy_) { _start_next(); }
+    _restore_irq(primask);
+    return &transfer;
+  }
+
+  void poll() {
+    /* Call from the main loop: time out a stalled transfer and pass completed
+     * transfers to their callbacks. */
+    const uint32_t primask = _disable_irq();
+    if (busy_ && (micros() - queue_[active_].start_us > timeout_us_)) {
+      _finish(I2cTransfer::TIMEOUT);
+    }
+    _restore_irq(primask);
+
+    while (dispatch_ != active_) {
+      I2cTransfer &transfer = queue_[dispatch_];
+      if (transfer.callback != NULL) {
+        transfer.callback(transfer.context, transfer);
+      }
+      dispatch_ = (dispatch_ + 1) & QUEUE_MASK;
+    }
+  }
+
+  bool idle() const { return !busy_ && (active_ == tail_); }
+  uint16_t available() const {
+    /* Number of transfers that may be queued before the queue is full.
+     *
+     * Completed transfers hold their slots until `poll()` is called. */
+    return QUEUE_MASK - ((tail_ - dispatch_) & QUEUE_MASK);
+  }
+  uint16_t pending(uint16_t tag) const {
+    /* Number of queued or active transfers with the specified tag. */
+    uint16_t count = 0;
+    for (uint16_t i = active_; i != tail_; i = (i + 1) & QUEUE_MASK) {
+      if (queue_[i].tag == tag) { count++; }
+    }
+    return count;
+  }
+  uint16_t cancel(uint16_t tag) {
+    /* Cancel waiting transfers with the specified tag (a transfer already on
+     * the bus completes, or times out, as usual).
+     *
+     * Cancelled transfers never touch the bus (or their `rx` buffer), and
+     * are passed to their callbacks from `poll()` with status `CANCELLED`.
+     * Returns the number of transfers cancelled. */
+    const uint32_t primask = _disable_irq();
+    uint16_t count = 0;
+    const uint16_t first = busy_ ? ((active_ + 1) & QUEUE_MASK) : active_;
+    for (uint16_t i = first; i != tail_; i = (i + 1) & QUEUE_MASK) {
+      if (queue_[i].tag == tag && queue_[i].status == I2cTransfer::QUEUED) {
+        queue_[i].status = I2cTransfer::CANCELLED;
+        count++;
+      }
+    }
+    _restore_irq(primask);
+    return count;
+  }
+  bool wait(uint32_t timeout_us) {
+    /* Block until the queue is empty (or until timeout).
+     *
+     * Returns `true` if the queue was emptied. */
+    const uint32_t start = micros();
+    while (!idle()) {
+      poll();
+      if (micros() - start > timeout_us) { return false; }
+    }
+    poll();
+    return true;
+  }
+
+  I2cMasterStats const &stats() const { return stats_; }
+  void reset_stats() { memset(&stats_, 0, sizeof(stats_)); }
+  uint32_t timeout_us() const { return timeout_us_; }
+  void set_timeout_us(uint32_t timeout_us) { timeout_us_ = timeout_us; }
+
+  void on_interrupt() {
+    const uint8_t status = registers_.S;
+    registers_.S = I2C_S_IICIF;
+
+    if (!busy_) { return; }
+    I2cTransfer &transfer = queue_[active_];
+
+    if (status & I2C_S_ARBL) {
+      registers_.S = I2C_S_ARBL;
+      _finish(I2cTransfer::ARBITRATION_LOST);
+      return;
+    }
+
+    switch (phase_) {
+      case WRITE:
+        if (status & I2C_S_RXAK) { _finish(I2cTransfer::NACK); return; }
+        if (index_ < transfer.tx_length) {
+          registers_.D = transfer.tx[index_++];
+        } else if (transfer.rx_length > 0) {
+          // Repeated start, then address device for reading.
+          registers_.C1 = (I2C_C1_IICEN | I2C_C1_IICIE | I2C_C1_MST |
+                           I2C_C1_TX | I2C_C1_RSTA);
+          registers_.D = (transfer.address << 1) | 1;
+          phase_ = ADDRESS_READ;
+        } else {
+          _finish(I2cTransfer::OK);
+        }
+        break;
+      case ADDRESS_READ:
+        if (status & I2C_S_RXAK) { _finish(I2cTransfer::NACK); return; }
+        index_ = 0;
+        // Switch to receive, and NACK immediately if only one byte is read.
+        registers_.C1 = (I2C_C1_IICEN | I2C_C1_IICIE | I2C_C1_MST |
+                         ((transfer.rx_length == 1) ? I2C_C1_TXAK : 0));
+        (void)registers_.D;  // Dummy read starts reception of first byte.
+        phase_ = READ;
+        break;
+      case READ: {
+        const uint8_t remaining = transfer.rx_length - index_;
+        if (remaining == 1) {
+          // Generate stop *before* reading the last byte, so that reading
+          // `D` does not start another reception.
+          registers_.C1 = I2C_C1_IICEN;
+          transfer.rx[index_++] = registers_.D;
+          _finish(I2cTransfer::OK, false);
+        } else {
+          if (remaining == 2) {
+            // NACK the last byte.
+            registers_.C1 = (I2C_C1_IICEN | I2C_C1_IICIE | I2C_C1_MST |
+                             I2C_C1_TXAK);
+          }
+          transfer.rx[index_++] = registers_.D;
+        }
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+private:
+  enum phase_t { IDLE, WRITE, ADDRESS_READ, READ };
+
+  static uint32_t _disable_irq() {
+    /* Disable interrupts and return the previous interrupt mask. */
+    uint32_t primask;
+    __asm__ volatile("mrs %0, primask\n\tcpsid i" : "=r" (primask)
+                     :: "memory");
+    return primask;
+  }
+  static void _restore_irq(uint32_t primask) {
+    __asm__ volatile("msr primask, %0" :: "r" (primask) : "memory");
+  }
+
+  void _start_next() {
+    /* Must be called with interrupts disabled. */
+    while (active_ != tail_ &&
+           queue_[active_].status == I2cTransfer::CANCELLED) {
+      queue_[active_].start_us = queue_[active_].end_us = micros();
+      active_ = (active_ + 1) & QUEUE_MASK;
+    }
+    if (active_ == tail_) {
+      busy_ = false;
+      phase_ = IDLE;
+      if (previous_isr_ != NULL) {
+        // Restore previous handler (e.g., `Wire` slave handler).
+        _VectorsRam[irq_ + 16] = previous_isr_;
+        previous_isr_ = NULL;
+      }
+      return;
+    }
+    if (previous_isr_ == NULL) {
+      previous_isr_ = _VectorsRam[irq_ + 16];
+      _VectorsRam[irq_ + 16] = isr_;
+      NVIC_ENABLE_IRQ(irq_);
+    }
+
+    // Wait (briefly) for the stop condition of a previous transfer.
+    for (uint16_t i = 0; (registers_.S & I2C_S_BUSY) && i < 1000; i++) {}
+
+    I2cTransfer &transfer = queue_[active_];
+    transfer.status = I2cTransfer::ACTIVE;
+    transfer.start_us = micros();
+    busy_ = true;
+    index_ = 0;
+
+    // Generate start condition and send address.
+    registers_.S = I2C_S_IICIF | I2C_S_ARBL;
+    registers_.C1 = I2C_C1_IICEN | I2C_C1_IICIE | I2C_C1_MST | I2C_C1_TX;
+    if (transfer.tx_length == 0 && transfer.rx_length > 0) {
+      registers_.D = (transfer.address << 1) | 1;
+      phase_ = ADDRESS_READ;
+    } else {
+      registers_.D = transfer.address << 1;
+      phase_ = WRITE;
+    }
+  }
+
+  void _finish(int8_t status, bool stop=true) {
+    /* Must be called with interrupts disabled (or from the interrupt). */
+    I2cTransfer &transfer = queue_[active_];
+    // Clear master bit to generate a stop condition.
+    if (stop) { registers_.C1 = I2C_C1_IICEN; }
+    transfer.end_us = micros();
+    transfer.status = status;
+
+    const uint32_t duration_us = transfer.duration_us();
+    stats_.busy_us += duration_us;
+    if (duration_us > stats_.max_transfer_us) {
+      stats_.max_transfer_us = duration_us;
+    }
+    switch (status) {
+      case I2cTransfer::OK:
+        stats_.completed++;
+        stats_.bytes += transfer.tx_length + transfer.rx_length;
+        break;
+      case I2cTransfer::NACK: stats_.nack++; break;
+      case I2cTransfer::ARBITRATION_LOST: stats_.arbitration_lost++; break;
+      case I2cTransfer::TIMEOUT: stats_.timeout++; break;
+    }
+
+    active_ = (active_ + 1) & QUEUE_MASK;
+    busy_ = false;
+    _start_next();
+  }
+
+  I2cRegisters &registers_;
+  const uint8_t irq_;
+  void (*isr_)(void);
+  void (*previous_isr_)(void);
+
+  I2cTransfer queue_[I2C_QUEUE_DEPTH];
+  // Transfers in `[dispatch_, active_)` are complete, `active_` is on the bus
+  // (if `busy_`), and `[active_, tail_)` are waiting.
+  volatile uint16_t dispatch_;
+  volatile uint16_t active_;
+  volatile uint16_t tail_;
+  volatile bool busy_;
+  uint8_t index_;
+  volatile phase_t phase_;
+  uint32_t timeout_us_;
+  I2cMasterStats stats_;
+};
+
+}  // namespace dropbot_dx
+
+
+#endif  // #ifndef ___I2C_MASTER__H___
@@ -5,26 +5,44 @@ namespace dropbot_dx {
 const float Node::R6 = 2e6;
 
 void Node::begin() {
+  /* Initialize everything needed to serve the serial link safely (with the
+   * high-voltage output disabled), then defer the rest to `_boot_step()`. */
+  trace_.begin();
   pinMode(LIGHT_PIN, OUTPUT);
-  pinMode(HIGH_PIN, OUTPUT);
-  pinMode(LOW_PIN, OUTPUT);
-  pinMode(MCP41050_CS_PIN, OUTPUT);
-  pinMode(SHDN_PIN, OUTPUT);
-  pinMode(SCK_PIN, OUTPUT);
-  pinMode(MOSI_PIN, OUTPUT);
-  pinMode(HV_OUTPUT_SELECT_PIN, OUTPUT);
+  pins::high_pin_t::output();
+  pins::low_pin_t::output();
+  pins::mcp41050_cs_pin_t::output();
+  pins::shdn_pin_t::output();
+  pins::sck_pin_t::output();
+  pins::mosi_pin_t::output();
+  pins::hv_output_select_pin_t::output();
 
   // set SPI pins high
-  digitalWrite(SCK_PIN, HIGH);
-  digitalWrite(MOSI_PIN, HIGH);
+  pins::sck_pin_t::high();
+  pins::mosi_pin_t::high();
 
   // ensure SS pins stay high for now
-  digitalWrite(MCP41050_CS_PIN, HIGH);
+  pins::mcp41050_cs_pin_t::high();
+  // Keep high-voltage converter shut down until the state is applied.
+  pins::shdn_pin_t::high();
+  boot_us_[BOOT_PINS] = micros();
 
+  // Config and state are encoded into (and decoded from) the start of the
+  // scratch arena whenever they are saved or validated, so no scratch lease
+  // may be held across a config/state update.
   config_.set_buffer(get_buffer());
   config_.validator_.set_node(*this);
   config_.reset();
   config_.load();
+  boot_us_[BOOT_CONFIG] = micros();
+
+  // Needed by the `frequency` state handler.
+  Timer1.initialize(50); // initialize timer1, and set a 0.05 ms period
+  Timer1.stop();
+
+  // attach timer_callback() as a timer overflow interrupt
+  Timer1.attachInterrupt(timer_callback);
+  boot_us_[BOOT_TIMER1] = micros();
 
   state_.set_buffer(get_buffer());
   state_.validator_.set_node(*this);
@@ -41,80 +59,841 @@ void Node::begin() {
   // set (which initializes the state to the default values supplied in the
   // state protocol buffer definition).
   state_.validate();
+  scratch_.release_views();
+  boot_us_[BOOT_STATE] = micros();
 
   Serial.begin(115200);
+#ifndef DISABLE_SERIAL
+  // Receive serial bytes from a timer interrupt, since the USB serial driver
+  // does not provide a receive callback.
+  serial_rx_.begin(packet_buffer, sizeof(packet_buffer));
+  serial_rx_timer_.begin(serial_rx_isr, SERIAL_RX_PERIOD_US);
+#endif  // #ifndef DISABLE_SERIAL
+  boot_us_[BOOT_SERIAL] = micros();
+  boot_phase_ = BOOT_I2C;
+}
 
-  // only set the i2c clock if we have a valid i2c address (i.e., if
-  // Wire.begin() was called
-  if (config_._.i2c_address > 0) {
-    Wire.setClock(400000);
+void Node::_boot_step() {
+  /* Run the next deferred boot phase (one per call to `loop()`). */
+  switch (boot_phase_) {
+    case BOOT_I2C:
+      // `Wire.begin()` is only called by the base class if we have a valid
+      // i2c address, but the switching boards are always accessed as an I2C
+      // master.
+      if (config_._.i2c_address == 0) {
+        Wire.begin();
+      }
+      Wire.setClock(400000);
+      i2c0_.begin(i2c0_master_isr);
+      if (config_._.switching_board_bus_map) { _begin_i2c1(); }
+      break;
+    case BOOT_SERVO:
+      // this method needs to be called after initializing the Timer1 library!
+      servo_.attach(config_._.servo_pin);
+      break;
+    case BOOT_ADC:
+      // Calibrates both ADCs.
+      adc_ = new ADC();
+      capture_.begin(*adc_, adc_buffer, capture_dma_isr);
+      break;
+    case BOOT_SWITCHING_BOARDS:
+      _initialize_switching_boards();
+      break;
+    default:
+      return;
   }
+  boot_us_[boot_phase_++] = micros();
+}
 
-  Timer1.initialize(50); // initialize timer1, and set a 0.05 ms period
-  Timer1.stop();
+void Node::_update_voltage_table() {
+  /* Rebuild the voltage table from the current config (see
+   * `_invalidate_voltage_table()`). */
+  dropbot_dx_Config const &config = config_._;
+  const pb_size_t calibration_size = (config.has_voltage_calibration
+                                      ? config.voltage_calibration.size : 0);
+  voltage_table_valid_ = true;
 
-  // attach timer_callback() as a timer overflow interrupt
-  Timer1.attachInterrupt(timer_callback);
+  // Calibration points are `(code, voltage)` pairs of `uint16_t`.
+  const uint16_t point_count = calibration_size / (2 * sizeof(uint16_t));
+  uint16_t points[VOLTAGE_CALIBRATION_SIZE / sizeof(uint16_t)];
+  memcpy(points, config.voltage_calibration.bytes, point_count * 2 *
+         sizeof(uint16_t));
+  bool calibrated = point_count >= 2;
+  for (uint16_t i = 1; calibrated && i < point_count; i++) {
+    calibrated = (points[2 * i] > points[2 * (i - 1)] &&
+                  points[2 * i] < POT_CODES);
+  }
+
+  uint16_t segment = 0;
+  for (uint16_t code = 0; code < POT_CODES; code++) {
+    float voltage;
+    if (calibrated) {
+      // Piecewise linear interpolation between calibration points
+      // (extrapolated from the first/last segment).
+      while (segment < point_count - 2 && code > points[2 * (segment + 1)]) {
+        segment++;
+      }
+      const float code_a = points[2 * segment];
+      const float code_b = points[2 * (segment + 1)];
+      const float voltage_a = points[2 * segment + 1];
+      const float voltage_b = points[2 * (segment + 1) + 1];
+      voltage = (voltage_a + (code - code_a) * (voltage_b - voltage_a) /
+                 (code_b - code_a));
+    } else {
+      // Ideal voltage divider model (potentiometer resistance decreases with
+      // code).
+      const float value = (POT_CODES - 1 - code) * config.pot_max /
+        (POT_CODES - 1);
+      voltage = 100 * 1.5 / 2.0 * (R6 / (value + config.R7) + 1);
+    }
+    voltage = constrain(voltage, 0, 0xFFFF);
+    voltage_table_[code] = voltage + 0.5;
+    // Keep table monotonic for lookups.
+    if (code > 0 && voltage_table_[code] < voltage_table_[code - 1]) {
+      voltage_table_[code] = voltage_table_[code - 1];
+    }
+  }
+}
+
+uint32_t Node::apply_state(UInt8Array serialized_state) {
+  /* Apply a multi-field state update (serialized `State` message) as a
+   * single transaction:
+   *
+   *  1. All fields are validated; if any field is invalid, *nothing* is
+   *     applied.
+   *  2. Changed fields are committed to the hardware in a fixed order
+   *     (output select, voltage, frequency, HV disable, light, magnet, HV
+   *     enable), with the potentiometer and waveform timer programmed at
+   *     most once each (besides the HV soft-start).  Unchanged fields are
+   *     skipped.
+   *
+   * The HV soft-start runs last, since it may be pre-empted by a
+   * high-priority command.  In that case, the output is left disabled (and
+   * `hv_output_enabled` is not committed), all other fields have been
+   * applied, and `STATE_HV_PREEMPTED` is returned.
+   *
+   * Returns a bit mask of rejected fields (bit `n - 1` for field number `n`;
+   * 0 on success), `STATE_DECODE_ERROR`, or `STATE_HV_PREEMPTED`.
+   *
+   * Fields not handled here (see `STATE_APPLIED_FIELDS`) are rejected. */
+  // Every `State` field must be handled below (and listed in
+  // `STATE_APPLIED_FIELDS`); the field table has one terminating entry.
+  static_assert(sizeof(dropbot_dx_State_fields) / sizeof(pb_field_t) == 6 + 1,
+                "`State` fields changed; update `apply_state()`.");
+
+  // `pb_decode()` silently skips unknown fields, so check the field numbers
+  // first.
+  uint32_t rejected = 0;
+  pb_istream_t scan = pb_istream_from_buffer(serialized_state.data,
+                                             serialized_state.length);
+  while (scan.bytes_left > 0) {
+    pb_wire_type_t wire_type;
+    uint32_t tag;
+    bool eof;
+    if (!pb_decode_tag(&scan, &wire_type, &tag, &eof) || eof ||
+        !pb_skip_field(&scan, wire_type)) {
+      return STATE_DECODE_ERROR;
+    }
+    if (tag == 0 || tag > 31) { return STATE_DECODE_ERROR; }
+    if (!(STATE_APPLIED_FIELDS & (1UL << (tag - 1)))) {
+      rejected |= 1UL << (tag - 1);
+    }
+  }
+  if (rejected) { return rejected; }
+
+  dropbot_dx_State update;
+  memset(&update, 0, sizeof(update));
+  pb_istream_t stream = pb_istream_from_buffer(serialized_state.data,
+                                               serialized_state.length);
+  if (!pb_decode(&stream, dropbot_dx_State_fields, &update)) {
+    return STATE_DECODE_ERROR;
+  }
+
+  // Validate all fields before touching the hardware.
+  if (update.has_voltage && (update.voltage > config_._.max_voltage ||
+                             _voltage_pot_code(update.voltage) < 0)) {
+    rejected |= 1UL << (dropbot_dx_State_voltage_tag - 1);
+  }
+  if (update.has_frequency && !_state_frequency_valid(update.frequency)) {
+    rejected |= 1UL << (dropbot_dx_State_frequency_tag - 1);
+  }
+  if (rejected) { return rejected; }
+
+  dropbot_dx_State &state = state_._;
+  const bool voltage_changed = (update.has_voltage &&
+                                update.voltage != state.voltage);
+  const bool frequency_changed = (update.has_frequency &&
+                                  update.frequency != state.frequency);
+  const bool hv_changed = (update.has_hv_output_enabled &&
+                           update.hv_output_enabled !=
+                           state.hv_output_enabled);
+
+  if (update.has_hv_output_selected &&
+      update.hv_output_selected != state.hv_output_selected) {
+    on_state_hv_output_selected_changed(update.hv_output_selected);
+    state.hv_output_selected = update.hv_output_selected;
+  }
+
+  const bool hv_enable = hv_changed && update.hv_output_enabled;
+  if (voltage_changed) {
+    state.voltage = update.voltage;
+    // Otherwise, the soft-start programs the final voltage.
+    if (!hv_enable) { _set_voltage(state.voltage); }
+  }
+  if (frequency_changed) {
+    // The waveform timer follows the frequency whether or not the output is
+    // enabled (as for a single-field update).
+    on_state_frequency_changed(update.frequency);
+    state.frequency = update.frequency;
+  }
+  if (hv_changed && !update.hv_output_enabled) {
+    on_state_hv_output_enabled_changed(false);
+    state.hv_output_enabled = false;
+  }
+
+  if (update.has_light_enabled &&
+      update.light_enabled != state.light_enabled) {
+    on_state_light_enabled_changed(update.light_enabled);
+    state.light_enabled = update.light_enabled;
+  }
+  if (update.has_magnet_engaged &&
+      update.magnet_engaged != state.magnet_engaged) {
+    on_state_magnet_engaged_changed(update.magnet_engaged);
+    state.magnet_engaged = update.magnet_engaged;
+  }
+
+  if (hv_enable) {
+    // Soft-start programs the final voltage and frequency.
+    if (on_state_hv_output_enabled_changed(true)) {
+      state.hv_output_enabled = true;
+    } else {
+      _set_voltage(state.voltage);
+      return STATE_HV_PREEMPTED;
+    }
+  }
+  return 0;
+}
 
-  // this method needs to be called after initializing the Timer1 library!
-  servo_.attach(config_._.servo_pin);
+void Node::_pump_filter() {
+  /* Pass samples recorded since the last call to the filter, in contiguous
+   * blocks of `adc_buffer`. */
+  const uint32_t written = capture_.samples_written();
+  if (written - filter_consumed_ > ADC_BUFFER_SIZE) {
+    // Samples were overwritten before being filtered; skip ahead to the
+    // oldest sample that is still valid (plus margin, since the ADC keeps
+    // writing while the filter runs).
+    filter_overruns_++;
+    filter_consumed_ = written - ADC_BUFFER_SIZE / 2;
+  }
+  while (filter_consumed_ != written) {
+    const uint32_t index = filter_consumed_ & (ADC_BUFFER_SIZE - 1);
+    const uint32_t count = min(written - filter_consumed_,
+                               ADC_BUFFER_SIZE - index);
+    filter_.process(&adc_buffer[index], count);
+    filter_consumed_ += count;
+  }
+  filter_elapsed_us_ = micros() - capture_.start_us();
+}
 
-  //_initialize_switching_boards();
+FloatArray Node::filter_stats() {
+  /* Returns:
+   *
+   *  - Input (ADC) sample rate (Hz).
+   *  - Output (filtered) sample rate (Hz).
+   *  - Mean filter cost (CPU cycles per input sample).
+   *  - Fraction of CPU time spent filtering.
+   *  - Number of filtered samples dropped (output ring full).
+   *  - Number of times the filter fell a full `adc_buffer` behind the ADC
+   *    (input samples were lost). */
+  UInt8Array buffer = get_buffer();
+  FloatArray output;
+  output.length = 6;
+  output.data = reinterpret_cast<float *>(&buffer.data[0]);
+
+  const float elapsed_s = filter_elapsed_us_ * 1e-6;
+  const uint32_t inputs = filter_.input_count();
+  output.data[0] = (elapsed_s > 0) ? inputs / elapsed_s : 0;
+  output.data[1] = (elapsed_s > 0) ? filter_.output_count() / elapsed_s : 0;
+  output.data[2] = (inputs > 0) ? (float)filter_.cycles() / inputs : 0;
+  output.data[3] = ((elapsed_s > 0)
+                    ? filter_.cycles() / (elapsed_s * F_CPU) : 0);
+  output.data[4] = filter_.dropped_count();
+  output.data[5] = filter_overruns_;
+  return output;
 }
 
-void Node::_initialize_switching_boards() {
-  // Check how many switching boards are connected.  Each additional board's
-  // address must equal the previous boards address +1 to be valid.
-  number_of_channels_ = 0;
-
-  for (uint8_t chip = 0; chip < 8; chip++) {
-    // set IO ports as inputs
-    buffer_[0] = PCA9505_CONFIG_IO_REGISTER;
-    buffer_[1] = 0xFF;
-    i2c_write((uint8_t)config_._.switching_board_i2c_address + chip,
-              UInt8Array_init(2, (uint8_t *)&buffer_[0]));
-
-    // read back the register value
-    // if it matches what we previously set, this might be a PCA9505 chip
-    if (i2c_read((uint8_t)config_._.switching_board_i2c_address + chip, 1).data[0] == 0xFF) {
-      // try setting all ports in output mode and initialize to ground
-      uint8_t port=0;
-      for (; port<5; port++) {
-        buffer_[0] = PCA9505_CONFIG_IO_REGISTER + port;
-        buffer_[1] = 0x00;
-        i2c_write((uint8_t)config_._.switching_board_i2c_address + chip,
-                  UInt8Array_init(2, (uint8_t *)&buffer_[0]));
-
-        // check that we successfully set the IO config register to 0x00
-        if (i2c_read((uint8_t)config_._.switching_board_i2c_address + chip, 1).data[0] != 0x00) {
-          return;
+void Node::_update_environment_sensor() {
+  /* Background sampling state machine for the HIH6000 sensor:
+   *
+   *  1. Address the sensor with no data to trigger a measurement.
+   *  2. Wait for the conversion to complete.
+   *  3. Read the 4 data bytes (repeating steps 2-3 while the data is stale).
+   *
+   * Transfers are queued on the non-blocking I2C master, and handled in
+   * `_handle_environment_transfer()`. */
+  const uint32_t period_ms = config_._.environment_sensor_period_ms;
+  if (period_ms == 0) { return; }
+  const uint32_t now = millis();
+
+  switch (environment_phase_) {
+    case ENVIRONMENT_IDLE:
+      if ((environment_samples_ + environment_errors_ == 0) ||
+          (now - environment_trigger_ms_ >= period_ms)) {
+        environment_trigger_ms_ = now;
+        if (i2c0_.enqueue(config_._.environment_sensor_i2c_address, NULL, 0,
+                          NULL, 0, ENVIRONMENT_SENSOR_TAG,
+                          &Node::_on_environment_transfer, this)) {
+          environment_phase_ = ENVIRONMENT_TRIGGERING;
         }
-        buffer_[0] = PCA9505_OUTPUT_PORT_REGISTER + port;
-        buffer_[1] = 0xFF;
-        i2c_write((uint8_t)config_._.switching_board_i2c_address + chip,
-                  UInt8Array_init(2, (uint8_t *)&buffer_[0]));
       }
+      break;
+    case ENVIRONMENT_CONVERTING:
+      if (now - environment_phase_ms_ >= environment_wait_ms_ &&
+          i2c0_.enqueue(config_._.environment_sensor_i2c_address, NULL, 0,
+                        environment_rx_, sizeof(environment_rx_),
+                        ENVIRONMENT_SENSOR_TAG,
+                        &Node::_on_environment_transfer, this)) {
+        environment_phase_ = ENVIRONMENT_READING;
+      }
+      break;
+    default:
+      break;
+  }
+}
 
-      // if port=5, it means that we successfully initialized all IO config
-      // registers to 0x00, and this is probably a PCA9505 chip
-      if (port==5) {
-        if (number_of_channels_ == 40 * chip) {
-          number_of_channels_ = 40 * (chip + 1);
-        }
+void Node::_handle_environment_transfer(I2cTransfer const &transfer) {
+  const bool read = transfer.rx_length > 0;
+  if ((read && environment_phase_ != ENVIRONMENT_READING) ||
+      (!read && environment_phase_ != ENVIRONMENT_TRIGGERING)) {
+    // Sampling was restarted while the transfer was queued.
+    return;
+  }
+  if (transfer.status != I2cTransfer::OK) {
+    environment_errors_++;
+    environment_phase_ = ENVIRONMENT_IDLE;
+    return;
+  }
+  environment_phase_ms_ = millis();
+  if (!read) {
+    environment_wait_ms_ = ENVIRONMENT_CONVERSION_MS;
+    environment_phase_ = ENVIRONMENT_CONVERTING;
+    return;
+  }
+
+  const uint16_t humidity = (environment_rx_[0] << 8) | environment_rx_[1];
+  const uint16_t temperature = (environment_rx_[2] << 8) | environment_rx_[3];
+  const uint8_t status = (humidity >> 14) & 0x03;
+  if (status == 1) {
+    // Data is stale (i.e., measurement still in progress).  Try again.
+    environment_wait_ms_ = ENVIRONMENT_RETRY_MS;
+    environment_phase_ = ENVIRONMENT_CONVERTING;
+    return;
+  } else if (status > 1) {
+    environment_errors_++;
+    environment_phase_ = ENVIRONMENT_IDLE;
+    return;
+  }
+  // See [Honeywell technical note][1] for conversion equations.
+  //
+  // [1]: http://sensing.honeywell.com/index.php/ci_id/142171/la_id/1/document/1/re_id/0
+  environment_humidity_ = (float)(humidity & 0x3FFF) / ((1 << 14) - 2);
+  environment_temperature_ = ((float)((temperature >> 2) & 0x3FFF) /
+                              ((1 << 14) - 2) * 165 - 40);
+  environment_sample_ms_ = environment_phase_ms_;
+  environment_samples_++;
+  environment_phase_ = ENVIRONMENT_IDLE;
+}
+
+int8_t Node::save_adc_preset(uint8_t index, uint8_t adc_num,
+                             UInt8Array name) {
+  /* Save the current register configuration of the specified ADC to an
+   * EEPROM preset slot, under a name of up to `ADC_PRESET_NAME_SIZE`
+   * characters.
+   *
+   * Returns 0 on success, -1 if the index or name is invalid, or -2 if the
+   * serialized registers do not fit in a slot. */
+  if (index >= ADC_PRESET_COUNT || adc_num > 1 || name.length == 0 ||
+      name.length > ADC_PRESET_NAME_SIZE) {
+    return -1;
+  }
+  UInt8Array registers = read_adc_registers(adc_num);
+  if (registers.length > ADC_PRESET_MAX_SIZE) { return -2; }
+
+  char padded_name[ADC_PRESET_NAME_SIZE];
+  memset(padded_name, 0, sizeof(padded_name));
+  memcpy(padded_name, name.data, name.length);
+  const uint16_t length = registers.length;
+
+  const uint16_t address = _adc_preset_address(index);
+  eeprom_write_block(padded_name, (void *)address, sizeof(padded_name));
+  eeprom_write_block(&length, (void *)(address + ADC_PRESET_NAME_SIZE),
+                     sizeof(length));
+  eeprom_write_block(registers.data, (void *)(address + ADC_PRESET_NAME_SIZE +
+                                              sizeof(length)), length);
+  return 0;
+}
+
+int8_t Node::apply_adc_preset(uint8_t index, uint8_t adc_num) {
+  /* Apply the register configuration saved in an EEPROM preset slot to the
+   * specified ADC, with its interrupt masked.
+   *
+   * The ADC is only recalibrated if the voltage reference changed.
+   *
+   * Returns -1 if the index is invalid, -2 if the slot is empty (or does not
+   * decode), and otherwise the result of `update_adc_registers()`. */
+  const uint32_t start_us = micros();
+  if (index >= ADC_PRESET_COUNT || adc_num > 1) { return -1; }
+
+  const uint16_t address = _adc_preset_address(index);
+  uint16_t length;
+  eeprom_read_block(&length, (void *)(address + ADC_PRESET_NAME_SIZE),
+                    sizeof(length));
+  // Erased EEPROM reads as `0xFF`.
+  if (length == 0 || length > ADC_PRESET_MAX_SIZE) { return -2; }
+
+  scratch_t::Lease<uint8_t> lease(scratch_, length);
+  if (!lease.ok()) { return -2; }
+  UInt8Array registers = lease.bytes();
+  eeprom_read_block(registers.data, (void *)(address + ADC_PRESET_NAME_SIZE +
+                                             sizeof(length)), length);
+
+  // Check the whole message decodes before touching any register, so a
+  // corrupt slot is never partially applied.
+  pb_istream_t stream = pb_istream_from_buffer(registers.data,
+                                               registers.length);
+  while (stream.bytes_left > 0) {
+    pb_wire_type_t wire_type;
+    uint32_t tag;
+    bool eof;
+    if (!pb_decode_tag(&stream, &wire_type, &tag, &eof) || eof ||
+        !pb_skip_field(&stream, wire_type)) {
+      return -2;
+    }
+  }
+
+  volatile uint32_t &SC2 = (adc_num == 0) ? ADC0_SC2 : ADC1_SC2;
+  const uint32_t reference = SC2 & ADC_SC2_REFSEL(3);
+  // Only the interrupt of the selected ADC starts or consumes conversions,
+  // so mask it (rather than all interrupts) while the registers are written,
+  // so no conversion is started from it with a partially applied
+  // configuration.  Serial, I2C, servo and modulation interrupts keep
+  // running.
+  const uint8_t irq = (adc_num == 0) ? IRQ_ADC0 : IRQ_ADC1;
+  const bool irq_enabled = NVIC_IS_ENABLED(irq);
+  NVIC_DISABLE_IRQ(irq);
+  const int8_t result = update_adc_registers(adc_num, registers);
+  if (irq_enabled) { NVIC_ENABLE_IRQ(irq); }
+
+  adc_preset_recalibrated_ = (SC2 & ADC_SC2_REFSEL(3)) != reference;
+  if (adc_preset_recalibrated_) {
+    ADC_Module &module = (adc_num == 0) ? *adc_->adc0 : *adc_->adc1;
+    module.calibrate();
+    module.wait_for_cal();
+  }
+  adc_preset_switch_us_ = micros() - start_us;
+  return result;
+}
+
+UInt8Array Node::adc_preset_name(uint8_t index) {
+  /* Name of a preset (empty if the slot is empty or the index is invalid). */
+  UInt8Array output = get_buffer();
+  output.length = 0;
+  if (index >= ADC_PRESET_COUNT) { return output; }
+
+  const uint16_t address = _adc_preset_address(index);
+  uint16_t length;
+  eeprom_read_block(&length, (void *)(address + ADC_PRESET_NAME_SIZE),
+                    sizeof(length));
+  if (length == 0 || length > ADC_PRESET_MAX_SIZE) { return output; }
+  eeprom_read_block(output.data, (void *)address, ADC_PRESET_NAME_SIZE);
+  while (output.length < ADC_PRESET_NAME_SIZE && output.data[output.length]) {
+    output.length++;
+  }
+  return output;
+}
+
+void Node::_initialize_switching_boards() {
+  /* Probe all switching board addresses and configure each PCA9505 chip
+   * found with all outputs off. */
+  const uint32_t timeout_us = i2c0_.timeout_us();
+  _set_i2c_timeout_us(SWITCHING_BOARD_PROBE_TIMEOUT_US);
+
+  for (uint8_t chip = 0; chip < MAX_SWITCHING_BOARDS; chip++) {
+    switching_board_status_[chip] = _probe_switching_board(chip);
+  }
+  _set_i2c_timeout_us(timeout_us);
+
+  memset(state_of_channels_, 0, sizeof(state_of_channels_));
+  _update_number_of_channels();
+  switching_board_scan_ms_ = millis();
+}
+
+uint8_t Node::_probe_switching_board(uint8_t chip) {
+  I2cMaster &bus = _switching_board_bus(chip);
+  const uint8_t address = config_._.switching_board_i2c_address + chip;
+  uint8_t data[2];
+  uint8_t value;
+
+  // set IO ports as inputs
+  data[0] = PCA9505_CONFIG_IO_REGISTER;
+  data[1] = 0xFF;
+  int8_t status = _i2c_transfer(bus, address, data, 2);
+  if (status == I2cTransfer::NACK) {
+    return SWITCHING_BOARD_ABSENT;
+  } else if (status != I2cTransfer::OK) {
+    return SWITCHING_BOARD_BUS_ERROR;
+  }
+
+  // read back the register value
+  // if it matches what we previously set, this might be a PCA9505 chip
+  status = _i2c_transfer(bus, address, data, 1, &value, 1);
+  if (status != I2cTransfer::OK) { return SWITCHING_BOARD_BUS_ERROR; }
+  if (value != 0xFF) { return SWITCHING_BOARD_MISMATCH; }
+
+  // try setting all ports in output mode and initialize to ground
+  for (uint8_t port = 0; port < 5; port++) {
+    data[0] = PCA9505_CONFIG_IO_REGISTER + port;
+    data[1] = 0x00;
+    if (_i2c_transfer(bus, address, data, 2) != I2cTransfer::OK ||
+        _i2c_transfer(bus, address, data, 1, &value, 1) != I2cTransfer::OK) {
+      return SWITCHING_BOARD_BUS_ERROR;
+    }
+    // check that we successfully set the IO config register to 0x00
+    if (value != 0x00) { return SWITCHING_BOARD_MISMATCH; }
+
+    data[0] = PCA9505_OUTPUT_PORT_REGISTER + port;
+    data[1] = 0xFF;
+    if (_i2c_transfer(bus, address, data, 2) != I2cTransfer::OK) {
+      return SWITCHING_BOARD_BUS_ERROR;
+    }
+  }
+  return SWITCHING_BOARD_OK;
+}
+
+void Node::_rescan_switching_boards() {
+  /* Check for switching boards that were connected or disconnected since the
+   * last scan.
+   *
+   * Boards that are still present are *not* reconfigured, so their outputs
+   * are left untouched. */
+  const uint32_t timeout_us = i2c0_.timeout_us();
+  _set_i2c_timeout_us(SWITCHING_BOARD_PROBE_TIMEOUT_US);
+
+  const uint16_t number_of_channels = number_of_channels_;
+  bool changed = false;
+  for (uint8_t chip = 0; chip < MAX_SWITCHING_BOARDS; chip++) {
+    I2cMaster &bus = _switching_board_bus(chip);
+    const uint8_t address = config_._.switching_board_i2c_address + chip;
+    uint8_t status = switching_board_status_[chip];
+    if (status == SWITCHING_BOARD_OK) {
+      // Board was present; check that it still responds.
+      uint8_t data = PCA9505_CONFIG_IO_REGISTER;
+      uint8_t value;
+      if (_i2c_transfer(bus, address, &data, 1, &value, 1) != I2cTransfer::OK) {
+        status = SWITCHING_BOARD_ABSENT;
+      }
+    } else if (_i2c_transfer(bus, address, NULL, 0) == I2cTransfer::OK) {
+      // A device acknowledged its address; configure it.
+      status = _probe_switching_board(chip);
+    } else {
+      status = SWITCHING_BOARD_ABSENT;
+    }
+    if (status != switching_board_status_[chip]) {
+      switching_board_status_[chip] = status;
+      changed = true;
+    }
+  }
+  _set_i2c_timeout_us(timeout_us);
+  switching_board_scan_ms_ = millis();
+
+  if (changed) {
+    _update_number_of_channels();
+    if (number_of_channels_ > number_of_channels) {
+      // Newly added channels start off.
+      memset(&state_of_channels_[number_of_channels / 8], 0,
+             (number_of_channels_ - number_of_channels) / 8);
+    }
+  }
+}
+
+void Node::_update_number_of_channels() {
+  // Each additional board's address must equal the previous boards address
+  // +1 to be valid.
+  uint8_t chip = 0;
+  while (chip < MAX_SWITCHING_BOARDS &&
+         switching_board_status_[chip] == SWITCHING_BOARD_OK &&
+         40 * (chip + 1) <= MAX_NUMBER_OF_CHANNELS) {
+    chip++;
+  }
+  number_of_channels_ = 40 * chip;
+}
+
+void Node::_begin_i2c1() {
+  /* Enable the second I2C module (`SCL1`/`SDA1` on pins 29/30) with the same
+   * bus clock as `Wire`. */
+  if (SIM_SCGC4 & SIM_SCGC4_I2C1) { return; }
+  SIM_SCGC4 |= SIM_SCGC4_I2C1;
+  I2C1_C1 = 0;
+  CORE_PIN29_CONFIG = PORT_PCR_MUX(2) | PORT_PCR_ODE | PORT_PCR_SRE | PORT_PCR_DSE;
+  CORE_PIN30_CONFIG = PORT_PCR_MUX(2) | PORT_PCR_ODE | PORT_PCR_SRE | PORT_PCR_DSE;
+  I2C1_F = I2C0_F;
+  I2C1_FLT = I2C0_FLT;
+  I2C1_C2 = I2C_C2_HDRS;
+  I2C1_C1 = I2C_C1_IICEN;
+  i2c1_.begin(i2c1_master_isr);
+}
+
+int8_t Node::_i2c_transfer(I2cMaster &bus, uint8_t address,
+                           uint8_t const *tx, uint8_t tx_length, uint8_t *rx,
+                           uint8_t rx_length) {
+  /* Queue a transfer and block until it completes.
+   *
+   * Returns the final transfer status (see `I2cTransfer::status_t`). */
+  volatile int8_t status = I2cTransfer::QUEUED;
+  if (bus.enqueue(address, tx, tx_length, rx, rx_length, 0,
+                  &Node::_on_blocking_transfer, (void *)&status) == NULL) {
+    return I2cTransfer::TIMEOUT;
+  }
+  // The engine times out a stalled transfer, so this always terminates.
+  while (status == I2cTransfer::QUEUED) { bus.poll(); }
+  return status;
+}
+
+FloatArray Node::frequency_sweep(float start_frequency, float end_frequency,
+                                 uint16_t n_points, bool log_spacing,
+                                 uint16_t settle_ms,
+                                 uint16_t samples_per_point,
+                                 uint8_t analog_pin) {
+  /* Step the waveform frequency from `start_frequency` to `end_frequency`
+   * and sample the specified analog input at each step (after waiting
+   * `settle_ms`).
+   *
+   * Returns a table with one row per point (see `SWEEP_COLUMNS`):
+   *
+   *     frequency, mean, standard deviation, min, max
+   *
+   * (ADC statistics are in ADC counts), or an empty array if the sweep
+   * parameters are invalid, the table does not fit in the buffer, or the
+   * sweep was pre-empted by a high-priority command.
+   *
+   * The waveform frequency is restored to the state frequency afterwards. */
+  UInt8Array buffer = get_buffer();
+  FloatArray output;
+  output.length = 0;
+  output.data = reinterpret_cast<float *>(&buffer.data[0]);
+
+  const float min_frequency = min(start_frequency, end_frequency);
+  const float max_frequency = max(start_frequency, end_frequency);
+  if (n_points < 2 || samples_per_point < 1 ||
+      n_points * SWEEP_COLUMNS * sizeof(float) > buffer.length ||
+      min_frequency <= 0 || min_frequency < config_._.min_frequency ||
+      max_frequency > config_._.max_frequency) {
+    return output;
+  }
+
+  // Frequencies were validated above, so the timer is retuned directly
+  // (i.e., without the state validator).
+  const float log_ratio = log(end_frequency / start_frequency);
+  bool preempted = false;
+  for (uint16_t i = 0; i < n_points && !preempted; i++) {
+    const float position = (float)i / (n_points - 1);
+    const float frequency =
+      (log_spacing ? start_frequency * exp(position * log_ratio)
+       : start_frequency + position * (end_frequency - start_frequency));
+    _set_waveform_frequency(frequency);
+    if (!_wait_ms(settle_ms)) {
+      preempted = true;
+      break;
+    }
+
+    uint32_t sum = 0;
+    uint64_t sum_of_squares = 0;
+    uint16_t minimum = 0xFFFF;
+    uint16_t maximum = 0;
+    for (uint16_t j = 0; j < samples_per_point; j++) {
+      const uint16_t value = ::analogRead(analog_pin);
+      sum += value;
+      sum_of_squares += (uint32_t)value * value;
+      minimum = min(minimum, value);
+      maximum = max(maximum, value);
+    }
+    const float mean = (float)sum / samples_per_point;
+    const float variance = ((float)sum_of_squares / samples_per_point -
+                            mean * mean);
+
+    float *row = &output.data[i * SWEEP_COLUMNS];
+    row[0] = frequency;
+    row[1] = mean;
+    row[2] = sqrt(max(variance, 0.f));
+    row[3] = minimum;
+    row[4] = maximum;
+  }
+
+  // Restore waveform.
+  if (state_._.frequency == 0) { // DC mode
+    pins::high_pin_t::high();
+    pins::low_pin_t::low();
+    Timer1.stop();
+  } else {
+    _set_waveform_frequency(state_._.frequency);
+    if (!state_._.hv_output_enabled) { Timer1.stop(); }
+  }
+
+  if (!preempted) { output.length = n_points * SWEEP_COLUMNS; }
+  return output;
+}
+
+void Node::_update_duty_port_states() {
+  /* Compute the output port states for each tick of the modulation period.
+   *
+   * The modulation timer may see a partially updated table, which only
+   * affects a single tick. */
+  const uint8_t port_count = number_of_channels_ / 8;
+  uint8_t on_slots[8];
+  for (uint8_t port = 0; port < port_count; port++) {
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      const uint16_t duty = channel_duty_[port * 8 + bit];
+      on_slots[bit] = (((state_of_channels_[port] >> bit) & 0x01)
+                       ? (duty * DUTY_SLOTS + 255) / 256 : 0);
+    }
+    for (uint8_t slot = 0; slot < DUTY_SLOTS; slot++) {
+      uint8_t state = 0;
+      for (uint8_t bit = 0; bit < 8; bit++) {
+        if (on_slots[bit] > slot) { state |= 1 << bit; }
+      }
+      duty_port_states_[slot][port] = state;
+    }
+  }
+}
+
+void Node::on_duty_tick() {
+  /* Called from the modulation timer interrupt. */
+  if (_channel_transfers_pending() > 0) {
+    // Writes from the previous tick are still on the bus.
+    duty_skipped_ticks_++;
+    return;
+  }
+  duty_slot_ = (duty_slot_ + 1) % DUTY_SLOTS;
+  duty_ticks_++;
+  _start_channel_update();
+
+  uint8_t const *port_states = duty_port_states_[duty_slot_];
+  uint8_t data[2];
+  for (uint8_t chip = 0; chip < number_of_channels_ / 40; chip++) {
+    for (uint8_t port = 0; port < 5; port++) {
+      const uint8_t i = chip * 5 + port;
+      if (port_states[i] == duty_written_states_[i]) { continue; }
+      data[0] = PCA9505_OUTPUT_PORT_REGISTER + port;
+      data[1] = ~port_states[i];
+      if (_queue_channel_transfer(chip, data, 2)) {
+        duty_written_states_[i] = port_states[i];
+        duty_port_writes_++;
       }
     }
   }
 }
 
+FloatArray Node::duty_modulation_stats() {
+  /* Returns:
+   *
+   *  - target modulation rate (Hz),
+   *  - achieved modulation rate (Hz, i.e., excluding skipped ticks),
+   *  - fraction of ticks skipped,
+   *  - mean number of port writes per tick,
+   *  - utilisation of the first and second I2C buses (0-1). */
+  UInt8Array buffer = get_buffer();
+  FloatArray output;
+  output.length = 6;
+  output.data = reinterpret_cast<float *>(&buffer.data[0]);
+
+  const float elapsed_s = (micros() - duty_start_us_) * 1e-6;
+  const uint32_t ticks = duty_ticks_;
+  const uint32_t total_ticks = ticks + duty_skipped_ticks_;
+  output.data[0] = (duty_tick_us_ > 0) ? 1e6 / (duty_tick_us_ * DUTY_SLOTS)
+                                       : 0;
+  output.data[1] = (elapsed_s > 0) ? ticks / (DUTY_SLOTS * elapsed_s) : 0;
+  output.data[2] = (total_ticks > 0) ? (float)duty_skipped_ticks_ / total_ticks
+                                     : 0;
+  output.data[3] = (ticks > 0) ? (float)duty_port_writes_ / ticks : 0;
+  output.data[4] = ((elapsed_s > 0)
+                    ? (i2c0_.stats().busy_us - duty_start_busy_us_[0]) *
+                    1e-6 / elapsed_s : 0);
+  output.data[5] = ((elapsed_s > 0)
+                    ? (i2c1_.stats().busy_us - duty_start_busy_us_[1]) *
+                    1e-6 / elapsed_s : 0);
+  return output;
+}
+
 void Node::timer_callback() {
-  uint8_t high_pin_state = digitalRead(Node::HIGH_PIN);
-  if (high_pin_state == HIGH) {
-    digitalWrite(Node::HIGH_PIN, LOW);
-    digitalWrite(Node::LOW_PIN, HIGH);
+  if (pins::high_pin_t::read()) {
+    pins::high_pin_t::low();
+    pins::low_pin_t::high();
   } else {
-    digitalWrite(Node::LOW_PIN, LOW);
-    digitalWrite(Node::HIGH_PIN, HIGH);
+    pins::low_pin_t::low();
+    pins::high_pin_t::high();
+  }
+}
+
+UInt32Array Node::benchmark_gpio(uint16_t iterations) {
+  /* Mean CPU cycles per call (including loop overhead) of:
+   *
+   *  - `digitalWrite()` and `FastPin::high()`,
+   *  - `digitalRead()` and `FastPin::read()`,
+   *  - `shiftOut()` and `shift_out_msb_first()` (one byte). */
+  UInt8Array buffer = get_buffer();
+  UInt32Array output;
+  output.length = 6;
+  output.data = reinterpret_cast<uint32_t *>(&buffer.data[0]);
+  if (iterations == 0) {
+    output.length = 0;
+    return output;
+  }
+
+  // The potentiometer chip-select is already high, and the potentiometer
+  // ignores the SPI pins while it is high, so none of the writes below
+  // change the hardware state.
+  uint32_t start;
+  uint8_t state = 0;
+
+  start = ARM_DWT_CYCCNT;
+  for (uint16_t i = 0; i < iterations; i++) {
+    digitalWrite(MCP41050_CS_PIN, HIGH);
+  }
+  output.data[0] = (ARM_DWT_CYCCNT - start) / iterations;
+
+  start = ARM_DWT_CYCCNT;
+  for (uint16_t i = 0; i < iterations; i++) {
+    pins::mcp41050_cs_pin_t::high();
   }
+  output.data[1] = (ARM_DWT_CYCCNT - start) / iterations;
+
+  start = ARM_DWT_CYCCNT;
+  for (uint16_t i = 0; i < iterations; i++) {
+    state += digitalRead(HIGH_PIN);
+  }
+  output.data[2] = (ARM_DWT_CYCCNT - start) / iterations;
+
+  start = ARM_DWT_CYCCNT;
+  for (uint16_t i = 0; i < iterations; i++) {
+    state += pins::high_pin_t::read();
+  }
+  output.data[3] = (ARM_DWT_CYCCNT - start) / iterations;
+
+  start = ARM_DWT_CYCCNT;
+  for (uint16_t i = 0; i < iterations; i++) {
+    shiftOut(MOSI_PIN, SCK_PIN, MSBFIRST, i);
+  }
+  output.data[4] = (ARM_DWT_CYCCNT - start) / iterations;
+
+  start = ARM_DWT_CYCCNT;
+  for (uint16_t i = 0; i < iterations; i++) {
+    shift_out_msb_first<pins::mosi_pin_t, pins::sck_pin_t>(i);
+  }
+  output.data[5] = (ARM_DWT_CYCCNT - start) / iterations;
+
+  // Keep reads from being optimized away.
+  asm volatile("" :: "r" (state));
+  return output;
 }
 
 }  // namespace dropbot_dx
@@ -34,6 +34,16 @@
 #include "dropbot_dx_state_validate.h"
 #include "DropbotDx/config_pb.h"
 #include "DropbotDx/state_pb.h"
+#include "ScratchArena.h"
+#include "SerialPacketQueue.h"
+#include "I2cMaster.h"
+#include "TraceBuffer.h"
+#include "BoardPins.h"
+#include "ServoMotion.h"
+#include "DispatchStats.h"
+#include "TriggeredCapture.h"
+#include "FilterPipeline.h"
+#include "ActuationProgram.h"
 
 
 const uint32_t ADC_BUFFER_SIZE = 4096;
@@ -54,14 +64,21 @@ extern void dma_ch12_isr(void);
 extern void dma_ch13_isr(void);
 extern void dma_ch14_isr(void);
 extern void dma_ch15_isr(void);
+extern void serial_rx_isr(void);
+extern void i2c0_master_isr(void);
+extern void i2c1_master_isr(void);
+extern void duty_tick_isr(void);
+extern void servo_tick_isr(void);
+extern void capture_dma_isr(void);
 
 namespace dropbot_dx {
 
 // Define the array that holds the conversions here.
 // buffer_size must be a power of two.
 // The buffer is stored with the correct alignment in the DMAMEM section
+// (circular DMA requires alignment to the buffer size in *bytes*).
 // the +0 in the aligned attribute is necessary b/c of a bug in gcc.
-DMAMEM static volatile int16_t __attribute__((aligned(ADC_BUFFER_SIZE+0))) adc_buffer[ADC_BUFFER_SIZE];
+DMAMEM static volatile int16_t __attribute__((aligned(ADC_BUFFER_SIZE * sizeof(int16_t) + 0))) adc_buffer[ADC_BUFFER_SIZE];
 
 
 const size_t FRAME_SIZE = (3 * sizeof(uint8_t)  // Frame boundary
@@ -77,6 +94,12 @@ typedef nanopb::EepromMessage<dropbot_dx_Config,
 typedef nanopb::Message<dropbot_dx_State,
                         state_validate::Validator<Node> > state_t;
 
+// Config and state are encoded into the scratch arena (see `Node::begin()`).
+static_assert(dropbot_dx_Config_size <= SCRATCH_ARENA_SIZE,
+              "Encoded `Config` does not fit in `SCRATCH_ARENA_SIZE`.");
+static_assert(dropbot_dx_State_size <= SCRATCH_ARENA_SIZE,
+              "Encoded `State` does not fit in `SCRATCH_ARENA_SIZE`.");
+
 class Node :
   public BaseNode,
   public BaseNodeEeprom,
@@ -92,38 +115,188 @@ public:
 
   static void timer_callback();
   Servo servo_;
-
-  static const uint32_t BUFFER_SIZE = 8192;  // >= longest property string
+  ServoMotion servo_motion_;
+  IntervalTimer servo_timer_;
+  bool servo_timer_active_;
+
+  // Scratch memory shared by RPC response encoding, I2C transfers and
+  // `get_buffer()` users.  See `SCRATCH_ARENA_SIZE` in `RPCBuffer.h`.
+  static const uint32_t BUFFER_SIZE = SCRATCH_ARENA_SIZE;
+  typedef ScratchArena<BUFFER_SIZE> scratch_t;
+#ifndef DISABLE_SERIAL
+  typedef SerialPacketQueue<SERIAL_RX_RING_SIZE, SERIAL_QUEUE_DEPTH,
+                            SERIAL_QUEUE_SLOT_SIZE, PACKET_SIZE> serial_queue_t;
+#endif  // #ifndef DISABLE_SERIAL
 
   static const uint16_t MAX_NUMBER_OF_CHANNELS = 120;
 
-  static const uint8_t HIGH_PIN = 6;
-  static const uint8_t LOW_PIN = 7;
-  static const uint8_t LIGHT_PIN = 5;
+  // Pins of the hardware revision selected by `HARDWARE_REVISION` (see
+  // `BoardPins.h`).
+  typedef board_pins_t pins;
+  static const uint8_t HIGH_PIN = pins::HIGH_PIN;
+  static const uint8_t LOW_PIN = pins::LOW_PIN;
+  static const uint8_t LIGHT_PIN = pins::LIGHT_PIN;
 
   // pins connected to the boost converter
-  static const uint8_t MCP41050_CS_PIN = 10;
-  static const uint8_t SHDN_PIN = 4;
+  static const uint8_t MCP41050_CS_PIN = pins::MCP41050_CS_PIN;
+  static const uint8_t SHDN_PIN = pins::SHDN_PIN;
 
-  static const uint8_t HV_OUTPUT_SELECT_PIN = 8;
+  static const uint8_t HV_OUTPUT_SELECT_PIN = pins::HV_OUTPUT_SELECT_PIN;
 
   // SPI pins
-  static const uint8_t SCK_PIN = 13;
-  static const uint8_t MOSI_PIN = 11;
+  static const uint8_t SCK_PIN = pins::SCK_PIN;
+  static const uint8_t MOSI_PIN = pins::MOSI_PIN;
 
   // PCA9505 (gpio) chip/register addresses
   static const uint8_t PCA9505_CONFIG_IO_REGISTER = 0x18;
   static const uint8_t PCA9505_OUTPUT_PORT_REGISTER = 0x08;
 
+  // Tags for switching board transfers queued on the I2C master (output
+  // writes, and output readbacks for `state_of_channels()`).
+  static const uint16_t CHANNEL_UPDATE_TAG = 1;
+  static const uint16_t CHANNEL_READ_TAG = 3;
+
+  // Switching board discovery.
+  static const uint8_t MAX_SWITCHING_BOARDS = 8;
+  static const uint32_t SWITCHING_BOARD_PROBE_TIMEOUT_US = 500;
+  static const uint8_t SWITCHING_BOARD_ABSENT = 0;
+  static const uint8_t SWITCHING_BOARD_OK = 1;
+  static const uint8_t SWITCHING_BOARD_MISMATCH = 2;  // Register readback failed.
+  static const uint8_t SWITCHING_BOARD_BUS_ERROR = 3;
+
+  // Channel duty-cycle modulation: each modulation period is split into
+  // `DUTY_SLOTS` ticks, and a channel with duty `d` (0-255) is on for
+  // `ceil(d * DUTY_SLOTS / 256)` ticks.
+  static const uint8_t DUTY_SLOTS = 16;
+  static const uint32_t MIN_DUTY_TICK_US = 100;
+
+  // Number of digital potentiometer (MCP41050) wiper codes.
+  static const uint16_t POT_CODES = 256;
+  // Must match `max_size` of `voltage_calibration` in `config.options`.
+  static const uint8_t VOLTAGE_CALIBRATION_SIZE = 64;
+
+  // Background environment sensor (HIH6000) sampling.
+  static const uint16_t ENVIRONMENT_SENSOR_TAG = 2;
+  static const uint8_t ENVIRONMENT_IDLE = 0;
+  static const uint8_t ENVIRONMENT_TRIGGERING = 1;  // Trigger write queued.
+  static const uint8_t ENVIRONMENT_CONVERTING = 2;  // Waiting for conversion.
+  static const uint8_t ENVIRONMENT_READING = 3;  // Read queued.
+  static const uint32_t ENVIRONMENT_CONVERSION_MS = 40;
+  static const uint32_t ENVIRONMENT_RETRY_MS = 2;
+
+  // Returned by `apply_state()` if the state could not be decoded.
+  static const uint32_t STATE_DECODE_ERROR = 0x80000000;
+  // Set in the result of `apply_state()` if the HV soft-start was pre-empted
+  // (the output is left disabled).
+  static const uint32_t STATE_HV_PREEMPTED = 0x40000000;
+  // `State` fields handled by `apply_state()` (bit `n - 1` for field number
+  // `n`).
+  static const uint32_t STATE_APPLIED_FIELDS =
+    ((1UL << (dropbot_dx_State_voltage_tag - 1)) |
+     (1UL << (dropbot_dx_State_frequency_tag - 1)) |
+     (1UL << (dropbot_dx_State_hv_output_enabled_tag - 1)) |
+     (1UL << (dropbot_dx_State_hv_output_selected_tag - 1)) |
+     (1UL << (dropbot_dx_State_light_enabled_tag - 1)) |
+     (1UL << (dropbot_dx_State_magnet_engaged_tag - 1)));
+
+  // Named ADC register presets, stored in EEPROM after the config.  Each
+  // slot holds a name, the length of the serialized registers (see
+  // `read_adc_registers()`), and the serialized registers.
+  static const uint16_t ADC_PRESET_EEPROM_ADDRESS = 1024;
+  static const uint8_t ADC_PRESET_COUNT = 4;
+  static const uint16_t ADC_PRESET_SLOT_SIZE = 256;
+  static const uint8_t ADC_PRESET_NAME_SIZE = 16;
+  static const uint16_t ADC_PRESET_MAX_SIZE = (ADC_PRESET_SLOT_SIZE -
+                                               ADC_PRESET_NAME_SIZE -
+                                               sizeof(uint16_t));
+  // Config is stored from address 0, as a length prefix and the encoded
+  // message.
+  static_assert(sizeof(uint16_t) + dropbot_dx_Config_size <=
+                ADC_PRESET_EEPROM_ADDRESS,
+                "Encoded `Config` overlaps the ADC preset EEPROM slots.");
+  static_assert(ADC_PRESET_EEPROM_ADDRESS +
+                ADC_PRESET_COUNT * ADC_PRESET_SLOT_SIZE <= E2END + 1,
+                "ADC preset slots do not fit in EEPROM.");
+
+  // Columns of each row in the table returned by `frequency_sweep()`.
+  static const uint8_t SWEEP_COLUMNS = 5;
+
+  // Boot phases, in order (see `boot_timings()`).  Phases from `BOOT_I2C` on
+  // are deferred to `loop()`, so they overlap with USB enumeration and the
+  // host connecting; commands are not processed until all phases are done.
+  enum boot_phase_t {
+    BOOT_PINS = 0,
+    BOOT_CONFIG,
+    BOOT_TIMER1,
+    BOOT_STATE,
+    BOOT_SERIAL,
+    BOOT_I2C,
+    BOOT_SERVO,
+    BOOT_ADC,
+    BOOT_SWITCHING_BOARDS,
+    BOOT_PHASE_COUNT
+  };
+
   // use dma with ADC0
   RingBufferDMA *dmaBuffer_;
+  TriggeredCapture<ADC_BUFFER_SIZE> capture_;
+  // Streaming filter, fed from `loop()` with samples recorded by `capture_`
+  // (see `start_filter()`).
+  FilterPipeline<FILTER_MAX_TAPS, FILTER_OUTPUT_SIZE> filter_;
+  bool filter_active_;
+  uint32_t filter_consumed_;  // Samples of `capture_` passed to `filter_`.
+  uint32_t filter_overruns_;
+  uint32_t filter_elapsed_us_;
+
+  ActuationProgram<ACTUATION_PROGRAM_SIZE> program_;
 
   static const float R6;
 
-  uint8_t buffer_[BUFFER_SIZE];
+  // High-voltage output (in 10 mV units) at each potentiometer code, built
+  // from `voltage_calibration` (or the ideal divider model) on first use
+  // after the related config fields change.  Voltage increases with code.
+  uint16_t voltage_table_[POT_CODES];
+  bool voltage_table_valid_;
+  uint8_t pot_code_;
+
+  scratch_t scratch_;
+  TraceBuffer<TRACE_BUFFER_SIZE> trace_;
+  DispatchStats<DISPATCH_STATS_SLOTS> dispatch_stats_;
+#ifndef DISABLE_SERIAL
+  serial_queue_t serial_rx_;
+  IntervalTimer serial_rx_timer_;
+#endif  // #ifndef DISABLE_SERIAL
   uint8_t state_of_channels_[MAX_NUMBER_OF_CHANNELS / 8];
   uint16_t number_of_channels_;
 
+  // Non-blocking I2C masters.  `i2c0_` shares the `Wire` bus; `i2c1_` is
+  // only enabled if `switching_board_bus_map` is non-zero.
+  I2cMaster i2c0_;
+  I2cMaster i2c1_;
+  uint32_t channel_update_start_us_;
+  // Latest completion time of the writes of the current update (on either
+  // bus).
+  uint32_t channel_update_end_us_;
+  uint32_t channel_update_us_;
+  uint32_t channel_update_errors_;
+  uint8_t switching_board_status_[MAX_SWITCHING_BOARDS];
+
+  uint8_t channel_duty_[MAX_NUMBER_OF_CHANNELS];
+  // Output port states for each tick of the modulation period.
+  uint8_t duty_port_states_[DUTY_SLOTS][MAX_NUMBER_OF_CHANNELS / 8];
+  // Port states most recently queued for writing by the modulation timer.
+  uint8_t duty_written_states_[MAX_NUMBER_OF_CHANNELS / 8];
+  IntervalTimer duty_timer_;
+  bool duty_modulation_active_;
+  uint32_t duty_tick_us_;
+  volatile uint8_t duty_slot_;
+  volatile uint32_t duty_ticks_;
+  volatile uint32_t duty_skipped_ticks_;
+  volatile uint32_t duty_port_writes_;
+  uint32_t duty_start_us_;
+  uint32_t duty_start_busy_us_[2];
+  uint32_t switching_board_scan_ms_;
+
   ADC *adc_;
   uint32_t adc_period_us_;
   uint32_t adc_timestamp_us_;
@@ -136,23 +309,60 @@ public:
   int8_t dma_channel_done_;
   int8_t last_dma_channel_done_;
   bool adc_read_active_;
+  uint8_t boot_phase_;  // Next boot phase.
+  uint32_t boot_us_[BOOT_PHASE_COUNT];  // `micros()` at end of each phase.
+  uint8_t environment_phase_;
+  uint32_t environment_phase_ms_;
+  uint32_t environment_wait_ms_;
+  uint32_t environment_trigger_ms_;
+  uint8_t environment_rx_[4];
+  float environment_humidity_;
+  float environment_temperature_;
+  uint32_t environment_sample_ms_;
+  uint32_t environment_samples_;
+  uint32_t environment_errors_;
+  uint32_t adc_preset_switch_us_;
+  bool adc_preset_recalibrated_;
   LinkedList<uint32_t> allocations_;
   LinkedList<uint32_t> aligned_allocations_;
 
   Node() : BaseNode(),
            BaseNodeConfig<config_t>(dropbot_dx_Config_fields),
-           BaseNodeState<state_t>(dropbot_dx_State_fields), dmaBuffer_(NULL),
+           BaseNodeState<state_t>(dropbot_dx_State_fields),
+           servo_motion_(servo_), servo_timer_active_(false), dmaBuffer_(NULL),
+           filter_active_(false), filter_consumed_(0), filter_overruns_(0),
+           filter_elapsed_us_(0),
+           i2c0_(*(I2cRegisters *)&I2C0_A1, IRQ_I2C0),
+           i2c1_(*(I2cRegisters *)&I2C1_A1, IRQ_I2C1),
+           channel_update_start_us_(0), channel_update_end_us_(0),
+           channel_update_us_(0),
+           channel_update_errors_(0), switching_board_scan_ms_(0),
+           duty_modulation_active_(false), duty_tick_us_(0), duty_slot_(0),
+           duty_ticks_(0), duty_skipped_ticks_(0), duty_port_writes_(0),
+           duty_start_us_(0), voltage_table_valid_(false), pot_code_(0),
+           environment_phase_(ENVIRONMENT_IDLE), environment_phase_ms_(0),
+           environment_wait_ms_(0), environment_trigger_ms_(0),
+           environment_humidity_(NAN), environment_temperature_(NAN),
+           environment_sample_ms_(0), environment_samples_(0),
+           environment_errors_(0),
+           adc_preset_switch_us_(0), adc_preset_recalibrated_(false),
            adc_period_us_(0), adc_timestamp_us_(0), adc_tick_tock_(false),
            adc_count_(0), dma_channel_done_(-1), last_dma_channel_done_(-1),
-           adc_read_active_(false) {
+           adc_read_active_(false), boot_phase_(BOOT_PINS) {
     pinMode(LED_BUILTIN, OUTPUT);
+    memset(channel_duty_, 0xFF, sizeof(channel_duty_));
+    memset(boot_us_, 0, sizeof(boot_us_));
   }
 
-  UInt8Array get_buffer() { return UInt8Array_init(sizeof(buffer_), buffer_); }
+  UInt8Array get_buffer() { return scratch_.available(); }
   /* This is a required method to provide a temporary buffer to the
-   * `BaseNode...` classes. */
+   * `BaseNode...` classes.
+   *
+   * Returns the part of the scratch arena that is not currently leased. */
 
   void begin();
+  bool boot_complete() const { return boot_phase_ >= BOOT_PHASE_COUNT; }
+  void _boot_step();
   /****************************************************************************
    * # User-defined methods #
    *
@@ -171,8 +381,59 @@ public:
    * [2]: https://github.com/wheeler-microfluidics/base_node_rpc
    */
   uint8_t servo_read() { return servo_.read(); }
-  void servo_write(uint8_t angle) { servo_.write(angle); }
-  void servo_write_microseconds(uint16_t us) { servo_.writeMicroseconds(us); }
+  void servo_write(uint8_t angle) {
+    /* Move servo immediately (stops any ramped move or pulse pattern). */
+    stop_magnet_motion();
+    trace_.record(TRACE_SERVO, 0, angle);
+    servo_.write(angle);
+  }
+  void servo_write_microseconds(uint16_t us) {
+    stop_magnet_motion();
+    trace_.record(TRACE_SERVO, 1, us);
+    servo_.writeMicroseconds(us);
+  }
+  bool pulse_magnet(uint16_t n_pulses, uint32_t period_ms, uint32_t dwell_ms) {
+    /* Toggle the magnet `n_pulses` times from its current state (see
+     * `magnet_engaged` state field), and return to it.
+     *
+     * Each pulse starts every `period_ms`, and the magnet returns to its
+     * current state `dwell_ms` after the start of each pulse.  Moves are
+     * ramped at the `servo_velocity` config field.
+     *
+     * Returns immediately; see `magnet_motion_complete()`.
+     *
+     * Returns `false` if `dwell_ms`, or `period_ms - dwell_ms`, is shorter
+     * than one servo tick (`SERVO_TICK_US`), or if the servo timer could not
+     * be started. */
+    if (n_pulses == 0 || !ServoMotion::valid_pulse(period_ms, dwell_ms)) {
+      return false;
+    }
+    const uint8_t engaged = config_._.engaged_angle;
+    const uint8_t disengaged = config_._.disengaged_angle;
+    const bool state = state_._.magnet_engaged;
+    __disable_irq();
+    servo_motion_.pulse(state ? engaged : disengaged,
+                        state ? disengaged : engaged, n_pulses, period_ms,
+                        dwell_ms, config_._.servo_velocity);
+    __enable_irq();
+    trace_.record(TRACE_SERVO, 2, n_pulses);
+    if (!_start_servo_timer()) {
+      stop_magnet_motion();
+      return false;
+    }
+    return true;
+  }
+  bool magnet_motion_complete() const {
+    /* `true` once a ramped magnet move or pulse pattern has finished. */
+    return servo_motion_.complete();
+  }
+  void stop_magnet_motion() {
+    /* Stop a ramped magnet move or pulse pattern at the current position. */
+    __disable_irq();
+    servo_motion_.stop();
+    __enable_irq();
+  }
+  float servo_position() const { return servo_motion_.position(); }
   bool servo_attached() { return servo_.attached(); }
 
   uint16_t number_of_channels() const { return number_of_channels_; }
@@ -188,22 +449,32 @@ public:
   }
 
   UInt8Array state_of_channels() {
-    for (uint8_t chip = 0; chip < number_of_channels_ / 40; chip++) {
-      for (uint8_t port = 0; port < 5; port++) {
-        Wire.beginTransmission((uint8_t)config_._.switching_board_i2c_address + chip);
-        Wire.write(PCA9505_OUTPUT_PORT_REGISTER + port);
-        Wire.endTransmission();
-
-        delayMicroseconds(100); // needed when using Teensy
-
-        Wire.requestFrom(config_._.switching_board_i2c_address + chip, 1);
-        if (Wire.available()) {
-          state_of_channels_[chip*5 + port] = ~Wire.read();
-        } else {
-          return UInt8Array_init_default();
-        }
+    if (duty_modulation_active_) {
+      // Outputs change on every modulation tick; report the requested states.
+      return UInt8Array_init(number_of_channels_ / 8, state_of_channels_);
+    }
+    const uint32_t errors = channel_update_errors_;
+    if (!_channel_queue_has_room()) { return UInt8Array_init_default(); }
+    // Outputs are read back into a separate (leased) buffer, so the cached
+    // states (which are written to the outputs) are only replaced if every
+    // read succeeded.
+    scratch_t::Lease<uint8_t> port_states(scratch_, number_of_channels_ / 8);
+    bool ok = port_states.ok();
+    for (uint8_t chip = 0; ok && chip < number_of_channels_ / 40; chip++) {
+      for (uint8_t port = 0; ok && port < 5; port++) {
+        const uint8_t register_address = PCA9505_OUTPUT_PORT_REGISTER + port;
+        ok = _queue_channel_transfer(chip, &register_address, 1,
+                                     &port_states[chip*5 + port], 1);
       }
     }
+    if (!ok || !_wait_i2c_idle() || channel_update_errors_ != errors) {
+      _cancel_channel_reads();
+      return UInt8Array_init_default();
+    }
+    for (uint16_t i = 0; i < number_of_channels_ / 8; i++) {
+      // Outputs are active-low.
+      state_of_channels_[i] = ~port_states[i];
+    }
     return UInt8Array_init(number_of_channels_ / 8,
                       (uint8_t *)&state_of_channels_[0]);
   }
@@ -220,71 +491,251 @@ public:
   }
 
   bool set_state_of_channels(UInt8Array channel_states) {
+    /* Queue writes of the new channel states to the switching boards.
+     *
+     * Returns as soon as the writes are queued; see
+     * `channel_update_pending()`.
+     *
+     * While duty-cycle modulation is running, the new states are written by
+     * the modulation timer instead. */
     if (channel_states.length == number_of_channels_ / 8) {
       for (uint16_t i = 0; i < channel_states.length; i++) {
         state_of_channels_[i] = channel_states.data[i];
       }
-      // Each PCA9505 chip has 5 8-bit output registers for a total of 40 outputs
-      // per chip. We can have up to 8 of these chips on an I2C bus, which means
-      // we can control up to 320 channels.
-      //   Each register represent 8 channels (i.e. the first register on the
-      // first PCA9505 chip stores the state of channels 0-7, the second register
-      // represents channels 8-15, etc.).
-      for (uint8_t chip = 0; chip < number_of_channels_ / 40; chip++) {
-        for (uint8_t port = 0; port < 5; port++) {
-          buffer_[0] = PCA9505_OUTPUT_PORT_REGISTER + port;
-          buffer_[1] = ~state_of_channels_[chip*5 + port];
-          i2c_write(config_._.switching_board_i2c_address + chip,
-                    UInt8Array_init(2, (uint8_t *)&buffer_[0]));
-          delayMicroseconds(200); // this delay is necessary if we are operating with a 400kbps i2c clock
-        }
+      if (duty_modulation_active_) {
+        _update_duty_port_states();
+        return true;
       }
-      return true;
+      return _write_channel_ports(state_of_channels_);
     }
     return false;
   }
 
+  bool set_channel_duty(UInt8Array duty) {
+    /* Set the duty cycle of each channel (0: always off, 255: always on).
+     *
+     * Only takes effect while duty-cycle modulation is running (see
+     * `start_duty_modulation()`). */
+    if (duty.length != number_of_channels_) { return false; }
+    memcpy(channel_duty_, duty.data, duty.length);
+    _update_duty_port_states();
+    return true;
+  }
+  UInt8Array channel_duty() {
+    return UInt8Array_init(number_of_channels_, channel_duty_);
+  }
+  bool start_duty_modulation(uint32_t period_us) {
+    /* Time-multiplex the channel outputs so that each channel is on for its
+     * duty fraction of every modulation period.
+     *
+     * On each tick (`period_us / DUTY_SLOTS`), only ports whose state differs
+     * from the previous tick are written.  A tick is skipped if the writes
+     * from the previous tick have not completed yet. */
+    const uint32_t tick_us = period_us / DUTY_SLOTS;
+    if (tick_us < MIN_DUTY_TICK_US) { return false; }
+    stop_duty_modulation();
+
+    _update_duty_port_states();
+    memcpy(duty_written_states_, state_of_channels_,
+           sizeof(duty_written_states_));
+    duty_slot_ = 0;
+    duty_ticks_ = 0;
+    duty_skipped_ticks_ = 0;
+    duty_port_writes_ = 0;
+    duty_start_us_ = micros();
+    duty_start_busy_us_[0] = i2c0_.stats().busy_us;
+    duty_start_busy_us_[1] = i2c1_.stats().busy_us;
+    duty_tick_us_ = tick_us;
+    duty_modulation_active_ = duty_timer_.begin(duty_tick_isr, tick_us);
+    return duty_modulation_active_;
+  }
+  void stop_duty_modulation() {
+    /* Stop modulation and write the (unmodulated) channel states. */
+    if (!duty_modulation_active_) { return; }
+    duty_timer_.end();
+    duty_modulation_active_ = false;
+    _write_channel_ports(state_of_channels_);
+  }
+  bool duty_modulation_active() const { return duty_modulation_active_; }
+  FloatArray duty_modulation_stats();
+
+  bool channel_update_pending() const {
+    return _channel_transfers_pending() > 0;
+  }
+  uint32_t channel_update_us() const {
+    /* Duration of the most recent complete channel update, i.e., from
+     * queueing the writes until the last write completed (on either bus). */
+    return channel_update_us_;
+  }
+  uint32_t channel_update_errors() const { return channel_update_errors_; }
+
+  UInt32Array i2c_master_stats() {
+    /* Return `I2cMasterStats` fields (in declaration order) of the first I2C
+     * bus, followed by the fields of the second I2C bus. */
+    UInt8Array buffer = get_buffer();
+    UInt32Array output;
+    output.length = 2 * sizeof(I2cMasterStats) / sizeof(uint32_t);
+    output.data = reinterpret_cast<uint32_t *>(&buffer.data[0]);
+    memcpy(&output.data[0], &i2c0_.stats(), sizeof(I2cMasterStats));
+    memcpy(&output.data[output.length / 2], &i2c1_.stats(),
+           sizeof(I2cMasterStats));
+    return output;
+  }
+  void reset_i2c_master_stats() {
+    i2c0_.reset_stats();
+    i2c1_.reset_stats();
+  }
+  void i2c_write(uint8_t address, UInt8Array data) {
+    /* Write to a device on the first I2C bus.
+     *
+     * Replaces the `Wire`-based `BaseNodeI2c::i2c_write()`, so the write is
+     * queued behind any switching board transfers instead of starting in the
+     * middle of one. */
+    if (data.length <= I2C_TRANSFER_MAX_TX) {
+      _i2c_transfer(i2c0_, address, data.data, data.length);
+    } else if (_wait_i2c_idle()) {
+      // Too long for a queued transfer; use `Wire` once the bus is idle.
+      BaseNodeI2c::i2c_write(address, data);
+    }
+  }
+  UInt8Array i2c_read(uint8_t address, uint8_t n_bytes_to_read) {
+    /* Read from a device on the first I2C bus (see `i2c_write()`).
+     *
+     * Returns an empty array if the device did not respond. */
+    UInt8Array output = get_buffer();
+    if (n_bytes_to_read > output.length) { n_bytes_to_read = output.length; }
+    if (n_bytes_to_read == 0 ||
+        _i2c_transfer(i2c0_, address, NULL, 0, output.data,
+                      n_bytes_to_read) != I2cTransfer::OK) {
+      output.length = 0;
+    } else {
+      output.length = n_bytes_to_read;
+    }
+    return output;
+  }
+
+  UInt8Array switching_board_topology() {
+    /* Return switching board topology record:
+     *
+     *  - `uint8`: bit mask of chips found (bit `i` set for chip `i`).
+     *  - `uint8`: number of consecutive chips (starting from chip 0) in use.
+     *  - `uint16`: number of channels.
+     *  - `uint8[8]`: status of each chip (see `SWITCHING_BOARD_...`). */
+    UInt8Array output = get_buffer();
+    uint8_t mask = 0;
+    for (uint8_t chip = 0; chip < MAX_SWITCHING_BOARDS; chip++) {
+      if (switching_board_status_[chip] == SWITCHING_BOARD_OK) {
+        mask |= 1 << chip;
+      }
+    }
+    output.data[0] = mask;
+    output.data[1] = number_of_channels_ / 40;
+    memcpy(&output.data[2], &number_of_channels_, sizeof(uint16_t));
+    memcpy(&output.data[4], switching_board_status_,
+           sizeof(switching_board_status_));
+    output.length = 4 + sizeof(switching_board_status_);
+    return output;
+  }
+  UInt8Array scan_switching_boards() {
+    /* Probe and configure all switching boards (all outputs off), then
+     * return the topology record (see `switching_board_topology()`). */
+    _initialize_switching_boards();
+    return switching_board_topology();
+  }
+
+  uint32_t apply_state(UInt8Array serialized_state);
+
+  bool _state_frequency_valid(float frequency) const {
+    return ((config_._.min_frequency <= frequency) &&
+            (frequency <= config_._.max_frequency));
+  }
+
   bool on_state_frequency_changed(float frequency) {
     /* This method is triggered whenever a frequency is included in a state
      * update. */
     if ((config_._.min_frequency <= frequency) &&
                 (frequency <= config_._.max_frequency)) {
       if (frequency == 0) { // DC mode
-        digitalWrite(Node::HIGH_PIN, HIGH); // set not blanked pin high
-        digitalWrite(Node::LOW_PIN, LOW); // set not blanked pin high
+        pins::high_pin_t::high(); // set not blanked pin high
+        pins::low_pin_t::low(); // set not blanked pin high
         Timer1.stop(); // stop timer
       } else {
-        Timer1.setPeriod(500000.0 / frequency); // set timer period in ms
-        Timer1.restart();
+        _set_waveform_frequency(frequency);
       }
       return true;
     }
     return false;
   }
 
+  FloatArray frequency_sweep(float start_frequency, float end_frequency,
+                             uint16_t n_points, bool log_spacing,
+                             uint16_t settle_ms, uint16_t samples_per_point,
+                             uint8_t analog_pin);
+
   float min_waveform_voltage() {
-    return 1.5 / 2.0 * (R6 / (config_._.pot_max + config_._.R7) + 1);
+    if (!voltage_table_valid_) { _update_voltage_table(); }
+    return 1e-2 * voltage_table_[0];
+  }
+  uint8_t pot_code() const {
+    /* Potentiometer code most recently written by a voltage update. */
+    return pot_code_;
+  }
+  UInt16Array voltage_table() {
+    /* Output voltage (in 10 mV units) at each potentiometer code. */
+    if (!voltage_table_valid_) { _update_voltage_table(); }
+    return UInt16Array_init(POT_CODES, voltage_table_);
   }
 
   bool _set_voltage(float voltage) {
-    float value = R6 / ( 2 * voltage / 1.5 - 1 ) - config_._.R7;
-    if ( voltage <= config_._.max_voltage && value <= config_._.pot_max && value >= 0 ) {
-      // This method is triggered whenever a voltage is included in a state
-      // update.
-
-      // take the SS pin low to select the chip:
-      digitalWrite(MCP41050_CS_PIN, LOW);
-
-      // send Command to write value and enable the pot
-      shiftOut(MOSI_PIN, SCK_PIN, MSBFIRST, 0x1F);
-      // send in the value via SPI:
-      shiftOut(MOSI_PIN, SCK_PIN, MSBFIRST, 255 - value / config_._.pot_max * 255);
-
-      // take the SS pin high to de-select the chip:
-      digitalWrite(MCP41050_CS_PIN, HIGH);
-      return true;
+    // This method is triggered whenever a voltage is included in a state
+    // update.
+    if (voltage > config_._.max_voltage) { return false; }
+    const int16_t code = _voltage_pot_code(voltage);
+    if (code < 0) { return false; }
+
+    // take the SS pin low to select the chip:
+    pins::mcp41050_cs_pin_t::low();
+
+    // send Command to write value and enable the pot
+    shift_out_msb_first<pins::mosi_pin_t, pins::sck_pin_t>(0x1F);
+    // send in the value via SPI:
+    shift_out_msb_first<pins::mosi_pin_t, pins::sck_pin_t>(code);
+
+    // take the SS pin high to de-select the chip (after the CS hold time):
+    delay_ns<SHIFT_OUT_HALF_PERIOD_NS>();
+    pins::mcp41050_cs_pin_t::high();
+    pot_code_ = code;
+    trace_.record(TRACE_VOLTAGE, 0, code);
+    return true;
+  }
+  int16_t _voltage_pot_code(float voltage) {
+    /* Returns potentiometer code closest to the specified voltage, or -1 if
+     * the voltage is outside the output range. */
+    if (!voltage_table_valid_) { _update_voltage_table(); }
+    if (voltage < 0) { return -1; }
+    const uint32_t target = voltage * 100 + 0.5;
+    if (target < voltage_table_[0] || target > voltage_table_[POT_CODES - 1]) {
+      return -1;
     }
-    return false;
+    // First code with output voltage at or above the target.
+    uint16_t low = 0;
+    uint16_t high = POT_CODES - 1;
+    while (low < high) {
+      const uint16_t middle = (low + high) / 2;
+      if (voltage_table_[middle] < target) { low = middle + 1; }
+      else { high = middle; }
+    }
+    if (low > 0 && (target - voltage_table_[low - 1] <
+                    voltage_table_[low] - target)) {
+      low--;
+    }
+    return low;
+  }
+  void _update_voltage_table();
+  void _invalidate_voltage_table() {
+    /* Rebuild the table on next use.  Called by the handlers of the config
+     * fields it depends on (which run *before* the new value is stored). */
+    voltage_table_valid_ = false;
   }
 
   bool on_state_voltage_changed(float voltage) {
@@ -297,21 +748,27 @@ public:
       // enable the MAX1771, then increase the voltage. Otherwise, if the voltage
       // is > ~100 the MAX1771 will not turn on.
       _set_voltage(15);
-      delay(100);
-      digitalWrite(SHDN_PIN, !value);
-      delay(100);
+      if (!_wait_ms(100)) { return false; }
+      pins::shdn_pin_t::low();
+      trace_.record(TRACE_HV_OUTPUT, true);
+      if (!_wait_ms(100)) {
+        // Pre-empted by a high-priority command; leave the output disabled.
+        pins::shdn_pin_t::high();
+        trace_.record(TRACE_HV_OUTPUT, false);
+        return false;
+      }
       _set_voltage(state_._.voltage);
-      Timer1.setPeriod(500000.0 / state_._.frequency); // set timer period in ms
-      Timer1.restart();
+      _set_waveform_frequency(state_._.frequency);
     } else {
-      digitalWrite(SHDN_PIN, !value);
+      pins::shdn_pin_t::high();
+      trace_.record(TRACE_HV_OUTPUT, false);
       Timer1.stop(); // stop timer
     }
     return true;
   }
 
   bool on_state_hv_output_selected_changed(bool value) {
-    digitalWrite(HV_OUTPUT_SELECT_PIN, !value);
+    pins::hv_output_select_pin_t::write(!value);
     return true;
   }
 
@@ -324,6 +781,63 @@ public:
     return true;
   }
 
+  bool on_config_switching_board_bus_map_changed(uint32_t value) {
+    if (value) { _begin_i2c1(); }
+    return true;
+  }
+
+  bool on_config_environment_sensor_period_ms_changed(uint32_t value) {
+    // Sample as soon as possible with the new period (a transfer that is
+    // already queued is ignored when it completes).
+    environment_phase_ = ENVIRONMENT_IDLE;
+    environment_samples_ = 0;
+    environment_errors_ = 0;
+    return true;
+  }
+
+  FloatArray environment_state() {
+    /* Most recent background sample of the environment sensor (see
+     * `environment_sensor_period_ms` config field), without any bus access.
+     *
+     * Returns relative humidity (0-1), temperature (degrees Celsius), age of
+     * the sample (ms), and the number of samples and of failed samples since
+     * sampling was (re)started.  Humidity and temperature are NaN until the
+     * first sample. */
+    UInt8Array buffer = get_buffer();
+    FloatArray output;
+    output.length = 5;
+    output.data = reinterpret_cast<float *>(&buffer.data[0]);
+    output.data[0] = environment_humidity_;
+    output.data[1] = environment_temperature_;
+    output.data[2] = millis() - environment_sample_ms_;
+    output.data[3] = environment_samples_;
+    output.data[4] = environment_errors_;
+    return output;
+  }
+
+  bool on_config_R7_changed(float value) {
+    _invalidate_voltage_table();
+    return true;
+  }
+  bool on_config_pot_max_changed(float value) {
+    _invalidate_voltage_table();
+    return true;
+  }
+  bool on_config_voltage_calibration_changed(UInt8Array value) {
+    _invalidate_voltage_table();
+    return true;
+  }
+  void load_config() {
+    /* Load config from EEPROM (field handlers are not called). */
+    BaseNodeConfig<config_t>::load_config();
+    _invalidate_voltage_table();
+  }
+  void reset_config() {
+    /* Reset config to defaults (field handlers are not called). */
+    BaseNodeConfig<config_t>::reset_config();
+    _invalidate_voltage_table();
+  }
+
   bool on_config_servo_pin_changed(uint32_t value) {
     servo_.attach(value);
     return true;
@@ -351,11 +865,351 @@ public:
   // TODO: Should likely be private, but need to add private handling to code
   // scraper/generator.
   void _initialize_switching_boards();
-  void _magnet_engage() { servo_.write(config_._.engaged_angle); }
-  void _magnet_disengage() { servo_.write(config_._.disengaged_angle); }
+  bool _write_channel_ports(uint8_t const *port_states) {
+    /* Queue writes of all output ports.
+     *
+     * Returns `false` (without queueing anything) if the I2C queues do not
+     * have room for every port, so outputs are never partially updated. */
+    if (!_channel_queue_has_room()) { return false; }
+    _start_channel_update();
+    // Each PCA9505 chip has 5 8-bit output registers for a total of 40 outputs
+    // per chip. We can have up to 8 of these chips on an I2C bus, which means
+    // we can control up to 320 channels.
+    //   Each register represent 8 channels (i.e. the first register on the
+    // first PCA9505 chip stores the state of channels 0-7, the second register
+    // represents channels 8-15, etc.).
+    uint8_t data[2];
+    for (uint8_t chip = 0; chip < number_of_channels_ / 40; chip++) {
+      for (uint8_t port = 0; port < 5; port++) {
+        data[0] = PCA9505_OUTPUT_PORT_REGISTER + port;
+        data[1] = ~port_states[chip*5 + port];
+        if (!_queue_channel_transfer(chip, data, 2)) { return false; }
+      }
+    }
+    return true;
+  }
+  void _update_duty_port_states();
+  void on_duty_tick();
+  void _set_waveform_frequency(float frequency) {
+    trace_.record(TRACE_FREQUENCY, 0, (frequency < 0xFFFF)
+                  ? (uint16_t)(frequency + 0.5) : 0xFFFF);
+    Timer1.setPeriod(500000.0 / frequency); // set timer period in ms
+    Timer1.restart();
+  }
+  uint8_t _probe_switching_board(uint8_t chip);
+  void _rescan_switching_boards();
+  void _update_number_of_channels();
+  int8_t _i2c_transfer(I2cMaster &bus, uint8_t address, uint8_t const *tx,
+                       uint8_t tx_length, uint8_t *rx=NULL,
+                       uint8_t rx_length=0);
+  void _set_i2c_timeout_us(uint32_t timeout_us) {
+    i2c0_.set_timeout_us(timeout_us);
+    i2c1_.set_timeout_us(timeout_us);
+  }
+  void _update_environment_sensor();
+  void _pump_filter();
+  void _handle_environment_transfer(I2cTransfer const &transfer);
+  static void _on_environment_transfer(void *context,
+                                       I2cTransfer const &transfer) {
+    static_cast<Node *>(context)->_handle_environment_transfer(transfer);
+  }
+  static void _on_blocking_transfer(void *context,
+                                    I2cTransfer const &transfer) {
+    *static_cast<volatile int8_t *>(context) = transfer.status;
+  }
+  void _begin_i2c1();
+  I2cMaster &_switching_board_bus(uint8_t chip) {
+    return ((config_._.switching_board_bus_map >> chip) & 0x01) ? i2c1_
+                                                                : i2c0_;
+  }
+  uint16_t _channel_transfers_pending() const {
+    return (i2c0_.pending(CHANNEL_UPDATE_TAG) +
+            i2c1_.pending(CHANNEL_UPDATE_TAG));
+  }
+  bool _channel_queue_has_room() {
+    /* `true` if one transfer per output port fits in the queue of each bus
+     * (must not be called from an interrupt). */
+    uint16_t needed[2] = {0, 0};
+    for (uint8_t chip = 0; chip < number_of_channels_ / 40; chip++) {
+      needed[(&_switching_board_bus(chip) == &i2c1_) ? 1 : 0] += 5;
+    }
+    // Release slots of completed transfers.
+    i2c0_.poll();
+    i2c1_.poll();
+    return (i2c0_.available() >= needed[0] && i2c1_.available() >= needed[1]);
+  }
+  void _start_channel_update() {
+    /* Mark the start of a batch of output writes (see
+     * `channel_update_us()`). */
+    channel_update_start_us_ = micros();
+    channel_update_end_us_ = channel_update_start_us_;
+  }
+  bool _wait_i2c_idle() {
+    /* Block until all queued transfers on both buses have completed. */
+    return i2c0_.wait(20000) && i2c1_.wait(20000);
+  }
+  void _cancel_channel_reads() {
+    /* Cancel output readbacks that are still queued, and block until none is
+     * on the bus, so no read completes into a buffer that is out of scope. */
+    i2c0_.cancel(CHANNEL_READ_TAG);
+    i2c1_.cancel(CHANNEL_READ_TAG);
+    // The engine times out a stalled transfer, so this always terminates.
+    while (i2c0_.pending(CHANNEL_READ_TAG) > 0 ||
+           i2c1_.pending(CHANNEL_READ_TAG) > 0) {
+      i2c0_.poll();
+      i2c1_.poll();
+    }
+  }
+  bool _queue_channel_transfer(uint8_t chip, uint8_t const *tx,
+                               uint8_t tx_length, uint8_t *rx=NULL,
+                               uint8_t rx_length=0) {
+    if (tx_length == 2) {
+      // Output port write (logged with active-high channel states).
+      trace_.record(TRACE_CHANNELS, chip, (tx[0] << 8) | (uint8_t)~tx[1]);
+    }
+    // Boards on different buses are updated concurrently.
+    return (_switching_board_bus(chip)
+            .enqueue(config_._.switching_board_i2c_address + chip, tx,
+                     tx_length, rx, rx_length,
+                     (rx_length > 0) ? CHANNEL_READ_TAG : CHANNEL_UPDATE_TAG,
+                     &Node::_on_channel_transfer, this) != NULL);
+  }
+  static void _on_channel_transfer(void *context,
+                                   I2cTransfer const &transfer) {
+    Node &node = *static_cast<Node *>(context);
+    if (transfer.status != I2cTransfer::OK &&
+        transfer.status != I2cTransfer::CANCELLED) {
+      node.channel_update_errors_++;
+    }
+    // Only output writes count towards the update time (see
+    // `_start_channel_update()`).
+    if (transfer.tag != CHANNEL_UPDATE_TAG) { return; }
+    // Callbacks of one bus are dispatched before those of the other, so the
+    // last callback is not necessarily the last write to complete.  Writes
+    // of an earlier batch completed before the start of the current batch.
+    if ((int32_t)(transfer.end_us - node.channel_update_end_us_) > 0) {
+      node.channel_update_end_us_ = transfer.end_us;
+    }
+    // Updated by every callback once both buses are done, so callbacks
+    // dispatched after the first to see no pending writes still count.
+    if (node._channel_transfers_pending() == 0) {
+      node.channel_update_us_ = (node.channel_update_end_us_ -
+                                 node.channel_update_start_us_);
+    }
+  }
+  bool _wait_ms(uint32_t duration_ms) {
+    /* Wait for the specified duration.
+     *
+     * Returns `false` early if a high-priority command is waiting in the
+     * serial packet queue. */
+    const uint32_t start = millis();
+    while (millis() - start < duration_ms) {
+#ifndef DISABLE_SERIAL
+      if (serial_rx_.high_priority_pending()) { return false; }
+#endif  // #ifndef DISABLE_SERIAL
+    }
+    return true;
+  }
+  void _magnet_engage() { _move_servo(config_._.engaged_angle); }
+  void _magnet_disengage() { _move_servo(config_._.disengaged_angle); }
+  void _move_servo(uint8_t angle) {
+    __disable_irq();
+    servo_motion_.move_to(angle, config_._.servo_velocity);
+    __enable_irq();
+    trace_.record(TRACE_SERVO, 0, angle);
+    if (!_start_servo_timer()) {
+      // No timer available for a ramped move; jump to the angle instead.
+      stop_magnet_motion();
+      servo_.write(angle);
+    }
+  }
+  bool _start_servo_timer() {
+    /* Returns `false` if no interval timer is available. */
+    if (!servo_timer_active_) {
+      servo_timer_active_ = servo_timer_.begin(servo_tick_isr, SERVO_TICK_US);
+    }
+    return servo_timer_active_;
+  }
 
   float test(float a) { return 2 * a; }
 
+#ifndef DISABLE_SERIAL
+  bool set_priority_commands(UInt16Array command_codes) {
+    /* Set command codes that are processed ahead of other queued packets.
+     *
+     * A high-priority packet waiting in the queue also aborts long-running
+     * operations (e.g., the high-voltage soft-start). */
+    return serial_rx_.set_priority_commands(command_codes);
+  }
+  uint16_t serial_queue_depth() const { return serial_rx_.size(); }
+  uint16_t serial_queue_high_water() const {
+    /* Largest number of complete packets waiting at once since reset. */
+    return serial_rx_.high_water();
+  }
+  void reset_serial_queue_high_water() { serial_rx_.reset_high_water(); }
+#endif  // #ifndef DISABLE_SERIAL
+
+  UInt32Array benchmark_gpio(uint16_t iterations);
+
+  bool start_capture(uint8_t pin, uint8_t trigger_pin, uint16_t trigger_value,
+                     bool greater_than, uint16_t pre_samples,
+                     uint16_t post_samples) {
+    /* Record `pin` continuously (ADC0) and capture a window of
+     * `pre_samples` before and `post_samples` after the ADC1 value of
+     * `trigger_pin` next crosses `trigger_value` (rising to greater than or
+     * equal to if `greater_than`, otherwise falling below).
+     *
+     * ADC settings (e.g., resolution, speed, averaging) are not changed.
+     *
+     * See `capture_status()` and `capture_read()`. */
+    filter_active_ = false;  // Streaming filter shares `adc_buffer`.
+    return capture_.start(pin, trigger_pin, trigger_value, greater_than,
+                          pre_samples, post_samples);
+  }
+  void stop_capture() { capture_.stop(); }
+  UInt32Array capture_status() {
+    /* Returns `(state, pre_samples, post_samples, trigger micros(), trigger
+     * cycle count, sample period (ns))`, where state is 0: idle, 1: filling
+     * pre-trigger samples, 2: armed, 3: triggered, 4: complete. */
+    return capture_.status(get_buffer());
+  }
+  UInt16Array capture_read(uint16_t offset, uint16_t count) {
+    /* Read captured window (empty until capture is complete). */
+    return capture_.read(offset, count, get_buffer());
+  }
+
+  bool configure_filter(uint8_t cic_stages, uint8_t cic_shift,
+                        uint8_t fir_decimation, uint16_t offset) {
+    /* Configure streaming filter (see `FilterPipeline`):
+     *
+     *  - `cic_stages`: number of CIC stages (1-4).
+     *  - `cic_shift`: CIC decimation ratio is `2^cic_shift`
+     *    (`cic_stages * cic_shift` must be at most 15).
+     *  - `fir_decimation`: FIR output is computed for every
+     *    `fir_decimation`-th CIC output.
+     *  - `offset`: subtracted from each raw ADC value. */
+    if (filter_active_) { return false; }
+    return filter_.configure(cic_stages, cic_shift, fir_decimation, offset);
+  }
+  bool set_filter_coefficients(UInt16Array coefficients) {
+    /* Set FIR coefficients (Q15, as `uint16_t`; at most `FILTER_MAX_TAPS`). */
+    if (filter_active_) { return false; }
+    return filter_.set_coefficients(reinterpret_cast<int16_t *>
+                                    (coefficients.data),
+                                    coefficients.length);
+  }
+  bool start_filter(uint8_t pin) {
+    /* Record `pin` continuously (ADC0, with the current ADC settings) and
+     * filter the samples as they are recorded.
+     *
+     * Stops any triggered capture (see `start_capture()`), since both use
+     * `adc_buffer`.  See `filter_read()` and `filter_stats()`. */
+    filter_.reset();
+    filter_consumed_ = 0;
+    filter_overruns_ = 0;
+    filter_elapsed_us_ = 0;
+    filter_active_ = capture_.start_stream(pin);
+    return filter_active_;
+  }
+  void stop_filter() {
+    if (!filter_active_) { return; }
+    capture_.stop();
+    _pump_filter();
+    filter_active_ = false;
+  }
+  UInt16Array filter_read() {
+    /* Pop filtered samples (`int16_t`, as `uint16_t`). */
+    return filter_.read(get_buffer());
+  }
+  UInt16Array filter_samples(UInt16Array samples) {
+    /* Filter `samples` (raw ADC values) from the initial filter state, and
+     * return the filtered samples (e.g., to compare against a reference
+     * implementation).  Not available while streaming. */
+    if (filter_active_) {
+      UInt16Array output;
+      output.data = NULL;
+      output.length = 0;
+      return output;
+    }
+    filter_.reset();
+    filter_.process(reinterpret_cast<int16_t *>(samples.data),
+                    samples.length);
+    return filter_.read(get_buffer());
+  }
+  FloatArray filter_stats();
+  UInt32Array boot_timings() {
+    /* Returns `micros()` (time since reset) at the end of each boot phase
+     * (see `boot_phase_t`), or 0 for phases not yet complete. */
+    UInt8Array buffer = get_buffer();
+    UInt32Array output;
+    output.length = BOOT_PHASE_COUNT;
+    output.data = reinterpret_cast<uint32_t *>(&buffer.data[0]);
+    memcpy(output.data, boot_us_, sizeof(boot_us_));
+    return output;
+  }
+
+  bool set_actuation_program(UInt8Array program) {
+    /* Load a program of timed channel states.  Each step is a `uint32_t`
+     * duration (ms) followed by the channel states (as passed to
+     * `set_state_of_channels()`).  The last step's states are kept once the
+     * program completes. */
+    return program_.load(program.data, program.length,
+                         number_of_channels_ / 8);
+  }
+  bool start_actuation_program_at(uint32_t start_us) {
+    /* Start the loaded program when `microseconds()` reaches `start_us`.
+     *
+     * Returns `false` if `start_us` has already passed, or if the number of
+     * channels has changed since the program was loaded (see
+     * `actuation_program_status()`).  See `actuation_program_status()` for
+     * the time the program actually started. */
+    return program_.arm(start_us, number_of_channels_ / 8);
+  }
+  void stop_actuation_program() { program_.stop(); }
+  UInt32Array actuation_program_status() {
+    /* Returns `(state, step, number of steps, requested start (us), actual
+     * start (us))`, where state is 0: idle, 1: armed, 2: running, 3:
+     * complete, 4: error (the number of channels changed since the program
+     * was loaded, or a step could not be applied). */
+    return program_.status(get_buffer());
+  }
+
+  UInt32Array dispatch_stats() {
+    /* Returns `(command code, count, total cycles, max cycles)` for each
+     * command processed since reset, where cycles are counted from the start
+     * of command processing until the response has been sent. */
+    return dispatch_stats_.read(get_buffer());
+  }
+  void reset_dispatch_stats() { dispatch_stats_.reset(); }
+
+  uint32_t trace_head() const {
+    /* Number of trace records since reset (i.e., the sequence number of the
+     * next record). */
+    return trace_.head();
+  }
+  UInt8Array trace_read(uint32_t sequence, uint16_t count) {
+    /* Read trace records without stopping recording.
+     *
+     * Returns the sequence number of the first record (`uint32_t`; later than
+     * `sequence` if older records were overwritten), followed by up to
+     * `count` 8-byte records (see `TraceRecord`). */
+    return trace_.read(sequence, count, get_buffer());
+  }
+  void reset_trace() { trace_.reset(); }
+  void set_trace_enabled(bool enabled) { trace_.set_enabled(enabled); }
+  bool trace_enabled() const { return trace_.enabled(); }
+
+  uint32_t scratch_size() const { return scratch_.size(); }
+  uint32_t scratch_high_water() const {
+    /* Largest number of scratch bytes leased at once since reset. */
+    return scratch_.high_water();
+  }
+  uint32_t scratch_overlap_errors() const {
+    /* Number of scratch leases refused because they would have overlapped a
+     * `get_buffer()` view still in use. */
+    return scratch_.overlap_errors();
+  }
+
   /////////////// METHODS TO SET/GET SETTINGS OF THE ADC ////////////////////
 
   void on_tick() {
@@ -849,6 +1703,22 @@ public:
     return teensy::adc::update_registers(adc_num, serialized_adc_msg);
   }
 
+  int8_t save_adc_preset(uint8_t index, uint8_t adc_num, UInt8Array name);
+  int8_t apply_adc_preset(uint8_t index, uint8_t adc_num);
+  UInt8Array adc_preset_name(uint8_t index);
+  uint32_t adc_preset_switch_us() const {
+    /* Duration of the most recent `apply_adc_preset()`, including
+     * recalibration. */
+    return adc_preset_switch_us_;
+  }
+  bool adc_preset_recalibrated() const {
+    /* `true` if the most recent `apply_adc_preset()` recalibrated the ADC. */
+    return adc_preset_recalibrated_;
+  }
+  uint16_t _adc_preset_address(uint8_t index) const {
+    return ADC_PRESET_EEPROM_ADDRESS + index * ADC_PRESET_SLOT_SIZE;
+  }
+
   UInt8Array read_pit_registers() {
     return teensy::pit::serialize_registers(get_buffer());
   }
@@ -963,6 +1833,36 @@ public:
     mem_fill((float *)address, value, size);
   }
   void loop() {
+    if (!boot_complete()) {
+      _boot_step();
+      return;
+    }
+    // Checked first, to minimize the delay before a program starts.
+    const int16_t program_step = program_.poll();
+    if (program_step >= 0) {
+      UInt8Array states = program_.step_states(program_step);
+      // The number of channels may change after loading (see
+      // `_update_number_of_channels()`).
+      if (states.length != number_of_channels_ / 8 ||
+          !set_state_of_channels(states)) {
+        program_.fail();
+      }
+    }
+    // Pass completed I2C transfers to their callbacks.
+    i2c0_.poll();
+    i2c1_.poll();
+    _update_environment_sensor();
+    if (filter_active_) { _pump_filter(); }
+    if (servo_timer_active_ && servo_motion_.complete()) {
+      servo_timer_.end();
+      servo_timer_active_ = false;
+    }
+    if (config_._.switching_board_scan_period_ms > 0 &&
+        (millis() - switching_board_scan_ms_ >
+         config_._.switching_board_scan_period_ms) &&
+        !channel_update_pending()) {
+      _rescan_switching_boards();
+    }
     if (dma_channel_done_ >= 0) {
       // DMA channel has completed.
       last_dma_channel_done_ = dma_channel_done_;
@@ -0,0 +1,110 @@
+#ifndef ___SCRATCH_ARENA__H___
+#define ___SCRATCH_ARENA__H___
+
+#include <stddef.h>
+#include <stdint.h>
+#include <CArrayDefs.h>
+
+
+namespace dropbot_dx {
+
+template <size_t Size>
+class ScratchArena {
+  /* # Shared scratch memory #
+   *
+   * Single block of SRAM shared by all short-lived users of scratch memory:
+   * RPC responses built with `get_buffer()`, and leases for buffers that are
+   * only used within a command (e.g., I2C readback in
+   * `Node::state_of_channels()` and the encoded registers decoded by
+   * `Node::apply_adc_preset()`).
+   *
+   * Typed leases are taken from the *end* of the arena and are released in
+   * reverse order when the `Lease` goes out of scope.  The view returned by
+   * `available()` starts at the beginning of the arena and ends at the
+   * oldest active lease, so it does not overlap any lease taken *before* the
+   * view.
+   *
+   * A lease taken while an earlier view is still in use would overlap it, so
+   * once a view has been handed out, a lease that would overlap it fails
+   * (`ok()` is `false`) until `release_views()` is called (e.g., after each
+   * command has been processed).  Take leases first, then call
+   * `get_buffer()`. */
+public:
+  template <typename T>
+  class Lease {
+    /* Scoped, typed reservation of `length` elements of type `T`.
+     *
+     * If the arena does not have enough free space, `ok()` returns `false`
+     * and `data` is `NULL`. */
+  public:
+    T *data;
+    size_t length;
+
+    Lease(ScratchArena &arena, size_t length_)
+      : data(NULL), length(0), arena_(arena), top_(arena.top_) {
+      data = reinterpret_cast<T *>(arena_.reserve(length_ * sizeof(T),
+                                                  __alignof__(T)));
+      if (data != NULL) { length = length_; }
+    }
+    ~Lease() { arena_.release(top_); }
+
+    bool ok() const { return data != NULL; }
+    T &operator[](size_t i) { return data[i]; }
+    UInt8Array bytes() {
+      return UInt8Array_init(length * sizeof(T), (uint8_t *)data);
+    }
+  private:
+    // Leases may not be copied (release order would be ambiguous).
+    Lease(Lease const &);
+    Lease &operator=(Lease const &);
+
+    ScratchArena &arena_;
+    size_t top_;
+  };
+
+  ScratchArena() : top_(Size), view_end_(0), high_water_(0),
+                   overlap_errors_(0) {}
+
+  UInt8Array available() {
+    /* Return the region of the arena that is not currently leased. */
+    if (top_ > view_end_) { view_end_ = top_; }
+    return UInt8Array_init(top_, &data_[0]);
+  }
+  void release_views() {
+    /* Declare that no view returned by `available()` is still in use. */
+    view_end_ = 0;
+  }
+  size_t size() const { return Size; }
+  size_t leased() const { return Size - top_; }
+  size_t high_water() const { return high_water_; }
+  uint32_t overlap_errors() const {
+    /* Number of leases refused because they would overlap a view. */
+    return overlap_errors_;
+  }
+
+private:
+  uint8_t *reserve(size_t bytes, size_t alignment) {
+    if (bytes > top_) { return NULL; }
+    // Round down to the requested (power of two) alignment.
+    const size_t start = (top_ - bytes) & ~(alignment - 1);
+    if (start < view_end_) {
+      overlap_errors_++;
+      return NULL;
+    }
+    top_ = start;
+    if (Size - top_ > high_water_) { high_water_ = Size - top_; }
+    return &data_[start];
+  }
+  void release(size_t top) { top_ = top; }
+
+  uint8_t __attribute__((aligned(4))) data_[Size];
+  size_t top_;
+  size_t view_end_;  // End of views handed out since `release_views()`.
+  size_t high_water_;
+  uint32_t overlap_errors_;
+};
+
+}  // namespace dropbot_dx
+
+
+#endif  // #ifndef ___SCRATCH_ARENA__H___
@@ -0,0 +1,268 @@
+#ifndef ___SERIAL_PACKET_QUEUE__H___
+#define ___SERIAL_PACKET_QUEUE__H___
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <Arduino.h>
+#include <NadaMQ.h>
+#include <CArrayDefs.h>
+#include <BaseNodeRpc/SerialHandler.h>
+
+
+#ifndef SERIAL_RX_RING_SIZE
+#define SERIAL_RX_RING_SIZE   256  // Must be a power of two.
+#endif  // #ifndef SERIAL_RX_RING_SIZE
+
+#ifndef SERIAL_QUEUE_DEPTH
+#define SERIAL_QUEUE_DEPTH   8
+#endif  // #ifndef SERIAL_QUEUE_DEPTH
+
+#ifndef SERIAL_QUEUE_SLOT_SIZE
+#define SERIAL_QUEUE_SLOT_SIZE   64  // Payload bytes per queued packet.
+#endif  // #ifndef SERIAL_QUEUE_SLOT_SIZE
+
+#ifndef SERIAL_RX_PERIOD_US
+#define SERIAL_RX_PERIOD_US   100
+#endif  // #ifndef SERIAL_RX_PERIOD_US
+
+
+namespace dropbot_dx {
+
+template <size_t RingSize, size_t Depth, size_t SlotSize, size_t PacketSize>
+class SerialPacketQueue {
+  /* # Interrupt-fed serial receive queue #
+   *
+   *  1. `on_rx_interrupt()` is called from a periodic timer interrupt and
+   *     moves bytes from the USB serial buffer into a byte ring.  If the ring
+   *     is full, bytes are left in the USB buffer (i.e., nothing is lost).
+   *  2. `pump()` parses bytes from the ring.  Each complete packet is copied
+   *     to a free queue slot.  A packet that is too large for a slot (or
+   *     arrives while all slots are in use) stays in the parser, and parsing
+   *     stalls until it has been processed.
+   *  3. `process_next()` copies the highest priority (then oldest) packet
+   *     into the processing buffer and passes it to the command processor.
+   *
+   * A packet is *high priority* if its command code (the first two bytes of
+   * the payload) is in the list set by `set_priority_commands()`. */
+public:
+  typedef PacketParser<FixedPacket> parser_t;
+  // Called before (`complete == false`) and after each packet is processed.
+  typedef void (*dispatch_hook_t)(uint16_t command_code, bool complete);
+  static const uint8_t MAX_PRIORITY_COMMANDS = 8;
+
+  SerialPacketQueue() : ring_head_(0), ring_tail_(0), rx_pending_(false),
+                        rx_high_priority_(false), rx_sequence_(0),
+                        sequence_(0), priority_command_count_(0),
+                        high_water_(0), dispatch_hook_(NULL) {
+    for (size_t i = 0; i < Depth; i++) {
+      slots_[i].used = false;
+      slots_[i].packet.reset_buffer(SlotSize, &slots_[i].payload[0]);
+    }
+  }
+
+  void begin(uint8_t *process_buffer, uint16_t process_buffer_size) {
+    rx_packet_.reset_buffer(sizeof(rx_buffer_), &rx_buffer_[0]);
+    parser_.reset(&rx_packet_);
+    process_packet_.reset_buffer(process_buffer_size, process_buffer);
+  }
+
+  void on_rx_interrupt() {
+    int16_t available = Serial.available();
+    while (available-- > 0) {
+      const uint16_t next = (ring_head_ + 1) & (RingSize - 1);
+      if (next == ring_tail_) { break; }
+      ring_[ring_head_] = Serial.read();
+      ring_head_ = next;
+    }
+  }
+
+  void pump() {
+    while (!rx_pending_ && ring_tail_ != ring_head_) {
+      uint8_t byte = ring_[ring_tail_];
+      ring_tail_ = (ring_tail_ + 1) & (RingSize - 1);
+      parser_.parse_byte(&byte);
+      if (parser_.parse_error_) {
+        parser_.reset(&rx_packet_);
+      } else if (parser_.message_completed_) {
+        _enqueue_rx_packet();
+      }
+    }
+  }
+
+  bool high_priority_pending() {
+    pump();
+    if (rx_pending_ && rx_high_priority_) { return true; }
+    for (size_t i = 0; i < Depth; i++) {
+      if (slots_[i].used && slots_[i].high_priority) { return true; }
+    }
+    return false;
+  }
+
+  template <typename Processor>
+  bool process_next(Processor &processor) {
+    /* Process the next queued packet (if any).
+     *
+     * Returns `true` if a packet was processed. */
+    pump();
+
+    int8_t next = -1;
+    bool next_high_priority = false;
+    uint32_t next_sequence = 0;
+    for (size_t i = 0; i < Depth; i++) {
+      Slot &slot = slots_[i];
+      if (slot.used && (next < 0 || _precedes(slot.high_priority,
+                                              slot.sequence,
+                                              next_high_priority,
+                                              next_sequence))) {
+        next = i;
+        next_high_priority = slot.high_priority;
+        next_sequence = slot.sequence;
+      }
+    }
+
+    if (rx_pending_ && (next < 0 || _precedes(rx_high_priority_,
+                                              rx_sequence_,
+                                              next_high_priority,
+                                              next_sequence))) {
+      _copy_packet(process_packet_, rx_packet_);
+      rx_pending_ = false;
+      parser_.reset(&rx_packet_);
+    } else if (next >= 0) {
+      _copy_packet(process_packet_, slots_[next].packet);
+      slots_[next].used = false;
+    } else {
+      return false;
+    }
+    if (dispatch_hook_ == NULL) {
+      process_packet_with_processor(process_packet_, processor);
+    } else {
+      const uint16_t command_code = _command_code(process_packet_);
+      dispatch_hook_(command_code, false);
+      process_packet_with_processor(process_packet_, processor);
+      dispatch_hook_(command_code, true);
+    }
+    return true;
+  }
+
+  void set_dispatch_hook(dispatch_hook_t hook) { dispatch_hook_ = hook; }
+
+  bool set_priority_commands(UInt16Array command_codes) {
+    if (command_codes.length > MAX_PRIORITY_COMMANDS) { return false; }
+    for (uint16_t i = 0; i < command_codes.length; i++) {
+      priority_commands_[i] = command_codes.data[i];
+    }
+    priority_command_count_ = command_codes.length;
+    return true;
+  }
+
+  uint16_t size() const {
+    uint16_t count = rx_pending_ ? 1 : 0;
+    for (size_t i = 0; i < Depth; i++) { count += slots_[i].used; }
+    return count;
+  }
+  uint16_t high_water() const { return high_water_; }
+  void reset_high_water() { high_water_ = size(); }
+
+private:
+  struct Slot {
+    FixedPacket packet;
+    uint8_t payload[SlotSize];
+    uint32_t sequence;
+    bool high_priority;
+    bool used;
+  };
+
+  static bool _precedes(bool a_high_priority, uint32_t a_sequence,
+                        bool b_high_priority, uint32_t b_sequence) {
+    if (a_high_priority != b_high_priority) { return a_high_priority; }
+    return (int32_t)(a_sequence - b_sequence) < 0;
+  }
+
+  static void _copy_packet(FixedPacket &destination,
+                           FixedPacket const &source) {
+    // Copy header fields, but keep destination payload buffer.
+    uint8_t *buffer = destination.payload_buffer_;
+    const uint16_t buffer_size = destination.buffer_size_;
+    destination = source;
+    destination.payload_buffer_ = buffer;
+    destination.buffer_size_ = buffer_size;
+    memcpy(buffer, source.payload_buffer_, source.payload_length_);
+  }
+
+  static uint16_t _command_code(FixedPacket const &packet) {
+    uint16_t command_code = 0;
+    if (packet.payload_length_ >= sizeof(uint16_t)) {
+      memcpy(&command_code, packet.payload_buffer_, sizeof(command_code));
+    }
+    return command_code;
+  }
+
+  bool _is_priority(FixedPacket const &packet) const {
+    if (packet.payload_length_ < sizeof(uint16_t)) { return false; }
+    const uint16_t command_code = _command_code(packet);
+    for (uint8_t i = 0; i < priority_command_count_; i++) {
+      if (priority_commands_[i] == command_code) { return true; }
+    }
+    return false;
+  }
+
+  void _enqueue_rx_packet() {
+    const uint32_t sequence = sequence_++;
+    const bool high_priority = _is_priority(rx_packet_);
+
+    if (rx_packet_.payload_length_ <= SlotSize) {
+      for (size_t i = 0; i < Depth; i++) {
+        Slot &slot = slots_[i];
+        if (slot.used) { continue; }
+        _copy_packet(slot.packet, rx_packet_);
+        slot.sequence = sequence;
+        slot.high_priority = high_priority;
+        slot.used = true;
+        parser_.reset(&rx_packet_);
+        _update_high_water();
+        return;
+      }
+    }
+    // Packet does not fit in a queue slot; keep it in the parser until it is
+    // processed.
+    rx_sequence_ = sequence;
+    rx_high_priority_ = high_priority;
+    rx_pending_ = true;
+    _update_high_water();
+  }
+
+  void _update_high_water() {
+    const uint16_t count = size();
+    if (count > high_water_) { high_water_ = count; }
+  }
+
+  // Byte ring (written from interrupt, read from main loop).
+  uint8_t ring_[RingSize];
+  volatile uint16_t ring_head_;
+  volatile uint16_t ring_tail_;
+
+  // Parser (and buffer for packets that do not fit in a slot).
+  parser_t parser_;
+  FixedPacket rx_packet_;
+  uint8_t rx_buffer_[PacketSize];
+  bool rx_pending_;
+  bool rx_high_priority_;
+  uint32_t rx_sequence_;
+
+  Slot slots_[Depth];
+  uint32_t sequence_;
+
+  // Packet passed to the command processor.
+  FixedPacket process_packet_;
+
+  uint16_t priority_commands_[MAX_PRIORITY_COMMANDS];
+  uint8_t priority_command_count_;
+  uint16_t high_water_;
+  dispatch_hook_t dispatch_hook_;
+};
+
+}  // namespace dropbot_dx
+
+
+#endif  // #ifndef ___SERIAL_PACKET_QUEUE__H___
@@ -0,0 +1,142 @@
+#ifndef ___SERVO_MOTION__H___
+#define ___SERVO_MOTION__H___
+
+#include <stdint.h>
+#include <Arduino.h>
+#include <Servo.h>
+
+
+#ifndef SERVO_TICK_US
+#define SERVO_TICK_US   5000
+#endif  // #ifndef SERVO_TICK_US
+
+
+namespace dropbot_dx {
+
+class ServoMotion {
+  /* # Servo motion engine #
+   *
+   * Moves a servo to a target angle at a fixed velocity, one step per call
+   * to `on_tick()` (from a timer interrupt, every `SERVO_TICK_US`).
+   *
+   * A *pulse pattern* moves to an away angle and back to a home angle
+   * `count` times.  Each pulse starts every `period_ms`, and the move back
+   * starts `dwell_ms` after the start of the pulse.
+   *
+   * All methods other than `on_tick()` must be called with the timer
+   * interrupt disabled or stopped (see `Node`). */
+public:
+  ServoMotion(Servo &servo)
+    : servo_(servo), position_(-1), target_(0), step_(0), pulses_(0),
+      pulse_ticks_(0), period_ticks_(0), dwell_ticks_(0), home_(0), away_(0),
+      complete_(true) {}
+
+  void move_to(uint8_t angle, float velocity) {
+    /* Move to `angle` at `velocity` (degrees/s; 0 to jump). */
+    pulses_ = 0;
+    _set_velocity(velocity);
+    _set_target(angle);
+  }
+
+  static bool valid_pulse(uint32_t period_ms, uint32_t dwell_ms) {
+    /* `true` if the move back starts at least one tick after the start of
+     * each pulse, and at least one tick before the next pulse. */
+    const uint32_t dwell_ticks = _ticks(dwell_ms);
+    return dwell_ticks > 0 && dwell_ticks < _ticks(period_ms);
+  }
+
+  bool pulse(uint8_t home, uint8_t away, uint16_t count, uint32_t period_ms,
+             uint32_t dwell_ms, float velocity) {
+    /* Returns `false` (without moving) unless `valid_pulse()`. */
+    if (!valid_pulse(period_ms, dwell_ms)) { return false; }
+    _set_velocity(velocity);
+    home_ = home;
+    away_ = away;
+    period_ticks_ = _ticks(period_ms);
+    dwell_ticks_ = _ticks(dwell_ms);
+    pulse_ticks_ = 0;
+    pulses_ = count;
+    _set_target(count ? away : home);
+    return true;
+  }
+
+  void stop() {
+    /* Stop at the current position.
+     *
+     * The position is read back from the servo on the next move, so the
+     * servo may also be written directly after calling `stop()`. */
+    pulses_ = 0;
+    position_ = -1;
+    complete_ = true;
+  }
+
+  bool on_tick() {
+    /* Returns `true` if the servo position changed. */
+    bool moved = false;
+    if (position_ < 0) { return moved; }
+    if (position_ != target_) {
+      const int32_t remaining = target_ - position_;
+      position_ = ((abs(remaining) <= step_) ? target_
+                   : position_ + ((remaining > 0) ? step_ : -step_));
+      servo_.write((position_ + 500) / 1000);
+      moved = true;
+    }
+    if (pulses_ > 0) {
+      pulse_ticks_++;
+      if (pulse_ticks_ >= period_ticks_) {
+        // Start next pulse (or finish at the home angle).
+        pulse_ticks_ = 0;
+        pulses_--;
+        _set_target(pulses_ ? away_ : home_);
+      } else if (pulse_ticks_ == dwell_ticks_) {
+        _set_target(home_);
+      }
+    } else if (position_ == target_) {
+      complete_ = true;
+    }
+    return moved;
+  }
+
+  bool complete() const { return complete_; }
+  float position() const {
+    return (position_ < 0) ? servo_.read() : 1e-3 * position_;
+  }
+  uint8_t target() const { return (target_ + 500) / 1000; }
+
+private:
+  static uint32_t _ticks(uint32_t duration_ms) {
+    return duration_ms * 1000UL / SERVO_TICK_US;
+  }
+  void _set_velocity(float velocity) {
+    // Step size in thousandths of a degree.
+    step_ = ((velocity > 0) ? max(1L, (int32_t)(velocity * SERVO_TICK_US *
+                                                1e-3))
+             : 180000L);
+  }
+  void _set_target(uint8_t angle) {
+    if (position_ < 0) {
+      // Position is unknown until the first move; jump to the target.
+      position_ = servo_.read() * 1000L;
+    }
+    target_ = angle * 1000L;
+    complete_ = false;
+  }
+
+  Servo &servo_;
+  // Angles in thousandths of a degree.
+  volatile int32_t position_;
+  volatile int32_t target_;
+  int32_t step_;
+  volatile uint16_t pulses_;
+  uint32_t pulse_ticks_;
+  uint32_t period_ticks_;
+  uint32_t dwell_ticks_;
+  uint8_t home_;
+  uint8_t away_;
+  volatile bool complete_;
+};
+
+}  // namespace dropbot_dx
+
+
+#endif  // #ifndef ___SERVO_MOTION__H___
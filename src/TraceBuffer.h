@@ -0,0 +1,129 @@
+#ifndef ___TRACE_BUFFER__H___
+#define ___TRACE_BUFFER__H___
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <Arduino.h>
+#include <CArrayDefs.h>
+
+
+#ifndef TRACE_BUFFER_SIZE
+#define TRACE_BUFFER_SIZE   256  // Records; must be a power of two.
+#endif  // #ifndef TRACE_BUFFER_SIZE
+
+
+namespace dropbot_dx {
+
+enum trace_event_t {
+  TRACE_RPC_BEGIN = 1,     // b: command code
+  TRACE_RPC_END = 2,       // b: command code
+  TRACE_CHANNELS = 3,      // a: chip, b: (register << 8) | output port state
+  TRACE_VOLTAGE = 4,       // b: potentiometer code
+  TRACE_FREQUENCY = 5,     // b: frequency (Hz)
+  TRACE_HV_OUTPUT = 6,     // a: enabled
+  TRACE_SERVO = 7,         // a: 0 for angle, 1 for pulse width (us), b: value
+  TRACE_DMA_DONE = 8,      // a: DMA channel
+};
+
+
+struct TraceRecord {
+  uint32_t cycles;  // `DWT_CYCCNT` (wraps every `2^32 / F_CPU` seconds).
+  uint8_t type;
+  uint8_t a;
+  uint16_t b;
+};
+
+
+template <size_t Size>
+class TraceBuffer {
+  /* # Event flight recorder #
+   *
+   * Fixed-size ring of 8-byte records, timestamped with the cycle counter.
+   * Once full, the oldest records are overwritten.
+   *
+   * `record()` may be called from any context (including interrupts), and
+   * reading records with `read()` does not stop recording.
+   *
+   * Each record has a sequence number (its position in the stream of all
+   * records since reset), so a reader can tell which records were
+   * overwritten between reads. */
+public:
+  static const uint32_t MASK = Size - 1;
+
+  TraceBuffer() : head_(0), enabled_(true) {}
+
+  void begin() {
+    // Enable cycle counter.
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+  }
+
+  void record(uint8_t type, uint8_t a=0, uint16_t b=0) {
+    if (!enabled_) { return; }
+    uint32_t primask;
+    __asm__ volatile("mrs %0, primask\n\tcpsid i" : "=r" (primask)
+                     :: "memory");
+    TraceRecord &record = records_[head_++ & MASK];
+    record.cycles = ARM_DWT_CYCCNT;
+    record.type = type;
+    record.a = a;
+    record.b = b;
+    __asm__ volatile("msr primask, %0" :: "r" (primask) : "memory");
+  }
+
+  UInt8Array read(uint32_t sequence, uint16_t count, UInt8Array buffer) {
+    /* Copy up to `count` records, starting at sequence number `sequence`
+     * (or the oldest record still in the ring, if later), to `buffer`.
+     *
+     * Output is the sequence number of the first record copied (`uint32_t`),
+     * followed by the records. */
+    const uint16_t max_count = ((buffer.length - sizeof(uint32_t)) /
+                                sizeof(TraceRecord));
+    if (count > max_count) { count = max_count; }
+
+    uint32_t head = head_;
+    uint32_t oldest = (head > Size) ? head - Size : 0;
+    if ((int32_t)(sequence - oldest) < 0) { sequence = oldest; }
+    if ((int32_t)(head - sequence) < count) {
+      count = ((int32_t)(head - sequence) > 0) ? head - sequence : 0;
+    }
+
+    TraceRecord *output = reinterpret_cast<TraceRecord *>
+      (&buffer.data[sizeof(uint32_t)]);
+    for (uint16_t i = 0; i < count; i++) {
+      output[i] = records_[(sequence + i) & MASK];
+    }
+
+    // Drop records that were overwritten while copying.
+    head = head_;
+    oldest = (head > Size) ? head - Size : 0;
+    uint16_t overwritten = 0;
+    if ((int32_t)(oldest - sequence) > 0) {
+      overwritten = min((uint32_t)count, oldest - sequence);
+      memmove(&output[0], &output[overwritten],
+              (count - overwritten) * sizeof(TraceRecord));
+    }
+    sequence += overwritten;
+    count -= overwritten;
+
+    memcpy(&buffer.data[0], &sequence, sizeof(sequence));
+    buffer.length = sizeof(uint32_t) + count * sizeof(TraceRecord);
+    return buffer;
+  }
+
+  uint32_t head() const { return head_; }
+  void reset() { head_ = 0; }
+  bool enabled() const { return enabled_; }
+  void set_enabled(bool enabled) { enabled_ = enabled; }
+
+private:
+  TraceRecord records_[Size];
+  volatile uint32_t head_;
+  volatile bool enabled_;
+};
+
+}  // namespace dropbot_dx
+
+
+#endif  // #ifndef ___TRACE_BUFFER__H___
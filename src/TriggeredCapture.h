@@ -0,0 +1,274 @@
+#ifndef ___TRIGGERED_CAPTURE__H___
+#define ___TRIGGERED_CAPTURE__H___
+
+#include <stddef.h>
+#include <stdint.h>
+#include <Arduino.h>
+#include <ADC.h>
+#include <DMAChannel.h>
+#include <CArrayDefs.h>
+
+
+namespace dropbot_dx {
+
+template <size_t Size>
+class TriggeredCapture {
+  /* # Oscilloscope-style triggered capture #
+   *
+   *  - ADC0 converts continuously, and DMA writes every sample to a circular
+   *    buffer (which must be aligned to its size in bytes).
+   *  - ADC1 converts continuously with the hardware compare function
+   *    enabled, so its conversion-complete interrupt only fires when the
+   *    compare condition is met.  The compare is level-sensitive, so it is
+   *    first set to the opposite of the trigger condition, and switched to
+   *    the trigger condition once that is met; i.e., the trigger fires on a
+   *    crossing of the trigger value, and the interrupt fires once per
+   *    crossing (rather than on every conversion).
+   *  - Once at least `pre` samples have been written, the first trigger
+   *    interrupt reprograms the DMA major loop count to `post`, so the DMA
+   *    stops by itself after `post` more samples.  The ADC0 sample stream is
+   *    not interrupted.  Crossings before then are ignored.
+   *
+   * Without a trigger (`start_stream()`), samples are recorded until
+   * `stop()`, and may be consumed from the ring as they arrive (see
+   * `samples_written()`).
+   *
+   * `on_trigger_interrupt()` must be called from `adc1_isr()`, and
+   * `on_dma_interrupt()` from the interrupt attached to `dma_`. */
+public:
+  enum state_t {
+    IDLE = 0,
+    FILLING = 1,  // Fewer than `pre` samples recorded.
+    ARMED = 2,
+    TRIGGERED = 3,  // Recording post-trigger samples.
+    COMPLETE = 4,
+    STREAMING = 5,
+  };
+
+  TriggeredCapture() : adc_(NULL), buffer_(NULL), state_(IDLE), pre_(0),
+                       post_(0), trigger_value_(0), greater_than_(true),
+                       trigger_compare_(false), wraps_(0), trigger_index_(0),
+                       start_us_(0), trigger_us_(0), trigger_cycles_(0),
+                       trigger_sample_count_(0) {}
+
+  void begin(ADC &adc, volatile int16_t *buffer, void (*dma_isr)(void)) {
+    adc_ = &adc;
+    buffer_ = buffer;
+    dma_.begin();
+    dma_.attachInterrupt(dma_isr);
+  }
+
+  bool start(uint8_t pin, uint8_t trigger_pin, uint16_t trigger_value,
+             bool greater_than, uint16_t pre, uint16_t post) {
+    /* Start recording, and arm the trigger once `pre` samples have been
+     * recorded.
+     *
+     * Trigger fires when the value of `trigger_pin` (on ADC1) crosses
+     * `trigger_value`, i.e., when it becomes greater than or equal to
+     * (`greater_than`) or less than `trigger_value` after having been on the
+     * other side.  A signal that is already past `trigger_value` does not
+     * trigger until it has returned. */
+    if (adc_ == NULL || post == 0 || pre + post > Size) { return false; }
+    stop();
+
+    pre_ = pre;
+    post_ = post;
+    trigger_value_ = trigger_value;
+    greater_than_ = greater_than;
+    trigger_sample_count_ = 0;
+    _start_dma();
+
+    _set_trigger_compare(false);
+    adc_->adc0->enableDMA();
+    state_ = FILLING;
+    start_us_ = micros();
+    adc_->adc0->startContinuous(pin);
+    adc_->adc1->startContinuous(trigger_pin);
+    adc_->adc1->enableInterrupts();
+    return true;
+  }
+
+  bool start_stream(uint8_t pin) {
+    /* Record `pin` continuously (without a trigger) until `stop()`. */
+    if (adc_ == NULL) { return false; }
+    stop();
+    _start_dma();
+    adc_->adc0->enableDMA();
+    state_ = STREAMING;
+    start_us_ = micros();
+    adc_->adc0->startContinuous(pin);
+    return true;
+  }
+
+  uint32_t samples_written() const {
+    /* Number of samples written to the ring since the start (modulo
+     * `2^32`). */
+    uint32_t primask;
+    __asm__ volatile("mrs %0, primask\n\tcpsid i" : "=r" (primask)
+                     :: "memory");
+    uint32_t wraps = wraps_;
+    const uint16_t remaining = dma_.TCD->CITER_ELINKNO;
+    // The major loop may have completed without its interrupt having run
+    // yet (the loop count is reloaded on completion).
+    const bool wrap_pending = ((DMA_INT & (1 << dma_.channel)) &&
+                               remaining > Size / 2);
+    __asm__ volatile("msr primask, %0" :: "r" (primask) : "memory");
+    if (wrap_pending) { wraps++; }
+    return wraps * Size + (Size - remaining);
+  }
+  uint32_t start_us() const { return start_us_; }
+
+  void stop() {
+    if (state_ == IDLE || adc_ == NULL) { return; }
+    adc_->adc1->disableInterrupts();
+    adc_->adc1->stopContinuous();
+    adc_->adc1->disableCompare();
+    adc_->adc0->stopContinuous();
+    adc_->adc0->disableDMA();
+    dma_.disable();
+    if (state_ != COMPLETE) { state_ = IDLE; }
+  }
+
+  void on_trigger_interrupt() {
+    (void)ADC1_RA;  // Clear conversion complete flag.
+    if (state_ != FILLING && state_ != ARMED) { return; }
+    if (!trigger_compare_) {
+      // Signal is on the other side of the trigger value; wait for it to
+      // cross.
+      _set_trigger_compare(true);
+      return;
+    }
+    if (samples_written() < pre_) {
+      // Crossed before `pre` samples were recorded; wait for the signal to
+      // return, and for the next crossing.
+      _set_trigger_compare(false);
+      return;
+    }
+
+    // Pause DMA requests (the ADC0 request stays pending) while the major
+    // loop count is changed.
+    DMA_CERQ = dma_.channel;
+    const uint32_t count = samples_written();
+    if (DMA_INT & (1 << dma_.channel)) {
+      // The ring wrapped just before this interrupt, and the DMA interrupt
+      // has not run yet.  Count the wrap here, so the DMA interrupt is not
+      // taken as the end of the post-trigger samples.
+      wraps_++;
+      DMA_CINT = dma_.channel;
+      NVIC_CLEAR_PENDING(IRQ_DMA_CH0 + dma_.channel);
+    }
+    trigger_cycles_ = ARM_DWT_CYCCNT;
+    trigger_us_ = micros();
+    trigger_index_ = _write_index();
+    trigger_sample_count_ = count;
+    dma_.TCD->CITER_ELINKNO = post_;
+    dma_.TCD->BITER_ELINKNO = post_;
+    dma_.TCD->CSR = DMA_TCD_CSR_INTMAJOR | DMA_TCD_CSR_DREQ;
+    state_ = TRIGGERED;
+    DMA_SERQ = dma_.channel;
+
+    adc_->adc1->disableInterrupts();
+    adc_->adc1->stopContinuous();
+  }
+
+  void on_dma_interrupt() {
+    // Already handled by `on_trigger_interrupt()`.
+    if (!(DMA_INT & (1 << dma_.channel))) { return; }
+    dma_.clearInterrupt();
+    if (state_ == TRIGGERED) {
+      adc_->adc0->stopContinuous();
+      adc_->adc0->disableDMA();
+      state_ = COMPLETE;
+    } else if (state_ == FILLING || state_ == ARMED ||
+               state_ == STREAMING) {
+      wraps_++;
+      if (state_ == FILLING) { state_ = ARMED; }
+    }
+  }
+
+  UInt32Array status(UInt8Array buffer) {
+    /* Returns state, pre/post-trigger sample counts, trigger time (`micros()`
+     * and cycle counter), and mean sample period (ns, measured from start to
+     * trigger). */
+    UInt32Array output;
+    output.length = 6;
+    output.data = reinterpret_cast<uint32_t *>(&buffer.data[0]);
+    output.data[0] = (state_ == FILLING && samples_written() >= pre_)
+      ? (uint32_t)ARMED : (uint32_t)state_;
+    output.data[1] = pre_;
+    output.data[2] = post_;
+    output.data[3] = trigger_us_;
+    output.data[4] = trigger_cycles_;
+    output.data[5] = (trigger_sample_count_ > 0)
+      ? (uint32_t)(1000. * (trigger_us_ - start_us_) / trigger_sample_count_)
+      : 0;
+    return output;
+  }
+
+  UInt16Array read(uint16_t offset, uint16_t count, UInt8Array buffer) {
+    /* Read `count` samples, starting `offset` samples into the captured
+     * window (i.e., `pre` samples before the trigger). */
+    UInt16Array output;
+    output.data = reinterpret_cast<uint16_t *>(&buffer.data[0]);
+    output.length = 0;
+    if (state_ != COMPLETE) { return output; }
+    const uint16_t window = pre_ + post_;
+    if (offset >= window) { return output; }
+    count = min(count, (uint16_t)(window - offset));
+    count = min(count, (uint16_t)(buffer.length / sizeof(uint16_t)));
+    const uint32_t start = trigger_index_ + Size - pre_ + offset;
+    for (uint16_t i = 0; i < count; i++) {
+      output.data[i] = buffer_[(start + i) & (Size - 1)];
+    }
+    output.length = count;
+    return output;
+  }
+
+  state_t state() const { return state_; }
+
+private:
+  void _set_trigger_compare(bool trigger) {
+    /* Set the ADC1 compare to the trigger condition (`trigger`), or to its
+     * opposite. */
+    trigger_compare_ = trigger;
+    adc_->adc1->enableCompare(trigger_value_,
+                              trigger ? greater_than_ : !greater_than_);
+  }
+  uint32_t _write_index() const {
+    return (((uint32_t)dma_.TCD->DADDR - (uint32_t)buffer_) /
+            sizeof(int16_t)) & (Size - 1);
+  }
+  void _start_dma() {
+    // Continuous DMA from ADC0 into ring buffer (one major loop per lap).
+    wraps_ = 0;
+    dma_.source(*(volatile uint16_t *)&ADC0_RA);
+    dma_.destinationCircular((volatile uint16_t *)buffer_,
+                             Size * sizeof(int16_t));
+    dma_.transferCount(Size);
+    dma_.TCD->CSR = DMA_TCD_CSR_INTMAJOR;
+    dma_.triggerAtHardwareEvent(DMAMUX_SOURCE_ADC0);
+    dma_.enable();
+  }
+
+  ADC *adc_;
+  volatile int16_t *buffer_;
+  DMAChannel dma_;
+  volatile state_t state_;
+  uint16_t pre_;
+  uint16_t post_;
+  uint16_t trigger_value_;
+  bool greater_than_;
+  // `true` if the ADC1 compare is set to the trigger condition.
+  volatile bool trigger_compare_;
+  volatile uint32_t wraps_;
+  uint32_t trigger_index_;
+  uint32_t start_us_;
+  uint32_t trigger_us_;
+  uint32_t trigger_cycles_;
+  uint32_t trigger_sample_count_;
+};
+
+}  // namespace dropbot_dx
+
+
+#endif  // #ifndef ___TRIGGERED_CAPTURE__H___
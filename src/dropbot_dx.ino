@@ -29,20 +29,45 @@ void adc0_isr() {
   //ADC0_RA; // clear interrupt
 }
 
-void serialEvent() { node_obj.serial_handler_.receiver()(Serial.available()); }
+// Serial bytes are received by a periodic timer interrupt (rather than in
+// `serialEvent()`, which only runs between calls to `loop()`).
+void serial_rx_isr() { node_obj.serial_rx_.on_rx_interrupt(); }
+
+void i2c0_master_isr() { node_obj.i2c0_.on_interrupt(); }
+void i2c1_master_isr() { node_obj.i2c1_.on_interrupt(); }
+
+void duty_tick_isr() { node_obj.on_duty_tick(); }
+void servo_tick_isr() { node_obj.servo_motion_.on_tick(); }
+
+// ADC1 conversions only complete an interrupt when the compare condition of a
+// triggered capture is met.
+void adc1_isr() { node_obj.capture_.on_trigger_interrupt(); }
+void capture_dma_isr() { node_obj.capture_.on_dma_interrupt(); }
+
+void rpc_dispatch_hook(uint16_t command_code, bool complete) {
+  node_obj.trace_.record(complete ? dropbot_dx::TRACE_RPC_END
+                         : dropbot_dx::TRACE_RPC_BEGIN, 0, command_code);
+  node_obj.dispatch_stats_.on_dispatch(command_code, complete);
+  // The response has been sent, so no scratch view is still in use.
+  if (complete) { node_obj.scratch_.release_views(); }
+}
 
 
 void setup() {
   node_obj.begin();
+  node_obj.serial_rx_.set_dispatch_hook(rpc_dispatch_hook);
 }
 
 
 void loop() {
-  /* Parse all new bytes that are available.  If the parsed bytes result in a
-   * completed packet, pass the complete packet to the command-processor to
-   * process the request. */
-  if (node_obj.serial_handler_.packet_ready()) {
-    node_obj.serial_handler_.process_packet(command_processor);
+  /* Parse all bytes received so far and pass every complete packet to the
+   * command-processor (high-priority commands first).
+   *
+   * Packets received during the deferred boot phases stay queued until boot
+   * is complete. */
+  for (uint8_t i = 0; node_obj.boot_complete() &&
+       i < SERIAL_QUEUE_DEPTH + 1; i++) {
+    if (!node_obj.serial_rx_.process_next(command_processor)) { break; }
   }
   node_obj.loop();
 }
@@ -51,79 +76,95 @@ void dma_ch0_isr(void) {
   DMA_CINT = 0;
   PDB0_SC = 0;  // Stop PDB timer.
   node_obj.dma_channel_done_ = 0;
+  node_obj.trace_.record(dropbot_dx::TRACE_DMA_DONE, 0);
 }
 void dma_ch1_isr(void) {
   DMA_CINT = 1;
   PDB0_SC = 0;  // Stop PDB timer.
   node_obj.dma_channel_done_ = 1;
+  node_obj.trace_.record(dropbot_dx::TRACE_DMA_DONE, 1);
 }
 void dma_ch2_isr(void) {
   DMA_CINT = 2;
   PDB0_SC = 0;  // Stop PDB timer.
   node_obj.dma_channel_done_ = 2;
+  node_obj.trace_.record(dropbot_dx::TRACE_DMA_DONE, 2);
 }
 void dma_ch3_isr(void) {
   DMA_CINT = 3;
   PDB0_SC = 0;  // Stop PDB timer.
   node_obj.dma_channel_done_ = 3;
+  node_obj.trace_.record(dropbot_dx::TRACE_DMA_DONE, 3);
 }
 void dma_ch4_isr(void) {
   DMA_CINT = 4;
   PDB0_SC = 0;  // Stop PDB timer.
   node_obj.dma_channel_done_ = 4;
+  node_obj.trace_.record(dropbot_dx::TRACE_DMA_DONE, 4);
 }
 void dma_ch5_isr(void) {
   DMA_CINT = 5;
   PDB0_SC = 0;  // Stop PDB timer.
   node_obj.dma_channel_done_ = 5;
+  node_obj.trace_.record(dropbot_dx::TRACE_DMA_DONE, 5);
 }
 void dma_ch6_isr(void) {
   DMA_CINT = 6;
   PDB0_SC = 0;  // Stop PDB timer.
   node_obj.dma_channel_done_ = 6;
+  node_obj.trace_.record(dropbot_dx::TRACE_DMA_DONE, 6);
 }
 void dma_ch7_isr(void) {
   DMA_CINT = 7;
   PDB0_SC = 0;  // Stop PDB timer.
   node_obj.dma_channel_done_ = 7;
+  node_obj.trace_.record(dropbot_dx::TRACE_DMA_DONE, 7);
 }
 void dma_ch8_isr(void) {
   DMA_CINT = 8;
   PDB0_SC = 0;  // Stop PDB timer.
   node_obj.dma_channel_done_ = 8;
+  node_obj.trace_.record(dropbot_dx::TRACE_DMA_DONE, 8);
 }
 void dma_ch9_isr(void) {
   DMA_CINT = 9;
   PDB0_SC = 0;  // Stop PDB timer.
   node_obj.dma_channel_done_ = 9;
+  node_obj.trace_.record(dropbot_dx::TRACE_DMA_DONE, 9);
 }
 void dma_ch10_isr(void) {
   DMA_CINT = 10;
   PDB0_SC = 0;  // Stop PDB timer.
   node_obj.dma_channel_done_ = 10;
+  node_obj.trace_.record(dropbot_dx::TRACE_DMA_DONE, 10);
 }
 void dma_ch11_isr(void) {
   DMA_CINT = 11;
   PDB0_SC = 0;  // Stop PDB timer.
   node_obj.dma_channel_done_ = 11;
+  node_obj.trace_.record(dropbot_dx::TRACE_DMA_DONE, 11);
 }
 void dma_ch12_isr(void) {
   DMA_CINT = 12;
   PDB0_SC = 0;  // Stop PDB timer.
   node_obj.dma_channel_done_ = 12;
+  node_obj.trace_.record(dropbot_dx::TRACE_DMA_DONE, 12);
 }
 void dma_ch13_isr(void) {
   DMA_CINT = 13;
   PDB0_SC = 0;  // Stop PDB timer.
   node_obj.dma_channel_done_ = 13;
+  node_obj.trace_.record(dropbot_dx::TRACE_DMA_DONE, 13);
 }
 void dma_ch14_isr(void) {
   DMA_CINT = 14;
   PDB0_SC = 0;  // Stop PDB timer.
   node_obj.dma_channel_done_ = 14;
+  node_obj.trace_.record(dropbot_dx::TRACE_DMA_DONE, 14);
 }
 void dma_ch15_isr(void) {
   DMA_CINT = 15;
   PDB0_SC = 0;  // Stop PDB timer.
   node_obj.dma_channel_done_ = 15;
+  node_obj.trace_.record(dropbot_dx::TRACE_DMA_DONE, 15);
 }